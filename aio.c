@@ -0,0 +1,603 @@
+#include "aio.h"
+#include "stats.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdio_ext.h>
+#include <string.h>
+
+//Sets up an io_uring with room for every slot and maps its queues. There is no liburing, so this
+//talks to the kernel through the raw system calls. Returns false if io_uring is unavailable.
+static bool aio_uring_init(AIOUring *u) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    u->fd = (int) syscall(__NR_io_uring_setup, AIO_SLOTS, &p);
+    if (u->fd < 0) {
+        return false;
+    }
+
+    //Kernels with a single mapping share it between the submission and completion queues
+    u->sq_len = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+    u->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single && u->cq_len > u->sq_len) {
+        u->sq_len = u->cq_len;
+    }
+    u->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    u->sq = (uint8_t *) mmap(NULL, u->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        u->fd, IORING_OFF_SQ_RING);
+    u->cq = single ? u->sq
+                   : (uint8_t *) mmap(NULL, u->cq_len, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+    u->sqes = (struct io_uring_sqe *) mmap(NULL, u->sqes_len, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+    if (u->sq == MAP_FAILED || u->cq == MAP_FAILED || u->sqes == MAP_FAILED) {
+        if (u->sq != MAP_FAILED) {
+            munmap(u->sq, u->sq_len);
+        }
+        if (!single && u->cq != MAP_FAILED) {
+            munmap(u->cq, u->cq_len);
+        }
+        if (u->sqes != MAP_FAILED) {
+            munmap(u->sqes, u->sqes_len);
+        }
+        close(u->fd);
+        return false;
+    }
+
+    u->sq_tail = (uint32_t *) (u->sq + p.sq_off.tail);
+    u->sq_array = (uint32_t *) (u->sq + p.sq_off.array);
+    u->sq_mask = *(uint32_t *) (u->sq + p.sq_off.ring_mask);
+    u->cq_head = (uint32_t *) (u->cq + p.cq_off.head);
+    u->cq_tail = (uint32_t *) (u->cq + p.cq_off.tail);
+    u->cq_mask = *(uint32_t *) (u->cq + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *) (u->cq + p.cq_off.cqes);
+    return true;
+}
+
+static void aio_uring_clear(AIOUring *u) {
+    if (u->cq != u->sq) {
+        munmap(u->cq, u->cq_len);
+    }
+    munmap(u->sq, u->sq_len);
+    munmap(u->sqes, u->sqes_len);
+    close(u->fd);
+}
+
+//Marks request i as finished with whatever its slot holds. last tells the reader not to expect more.
+static void aio_ring_complete(AIORing *q, uint64_t i, bool last, bool error) {
+    uint64_t slot = i % AIO_SLOTS;
+    q->last[slot] = last || error;
+    q->error = q->error || error;
+    q->ready[slot] = true;
+}
+
+//Queues the rest of request i on the io_uring. Reads and writes go through a single iovec, which
+//every kernel with io_uring supports.
+static void aio_uring_push(AIORing *q, uint64_t i) {
+    AIOUring *u = &q->uring;
+    StatTimer timer;
+    uint64_t slot = i % AIO_SLOTS;
+
+    u->iovs[slot].iov_base = q->slots[slot] + q->lens[slot];
+    u->iovs[slot].iov_len = q->wants[slot] - q->lens[slot];
+
+    uint32_t tail = *u->sq_tail;
+    uint32_t index = tail & u->sq_mask;
+    struct io_uring_sqe *sqe = &u->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = q->write ? IORING_OP_WRITEV : IORING_OP_READV;
+    sqe->fd = q->fd;
+    sqe->addr = (uint64_t) (uintptr_t) &u->iovs[slot];
+    sqe->len = 1;
+    sqe->off = q->base + i * AIO_SLOT_SIZE + q->lens[slot];
+    sqe->user_data = i;
+    u->sq_array[index] = index;
+    __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    stats_start(&timer);
+    long submitted;
+    while ((submitted = syscall(__NR_io_uring_enter, u->fd, 1, 0, 0, NULL, 0)) < 0 && errno == EINTR) {
+    }
+    stats_stop(&timer, PHASE_IO);
+    if (submitted != 1) {
+        aio_ring_complete(q, i, true, true);
+    }
+}
+
+//Handles every completion the kernel has posted. A short transfer is resubmitted for the rest, and
+//a read that comes back empty has reached the end of the file.
+static void aio_uring_reap(AIORing *q) {
+    AIOUring *u = &q->uring;
+    uint32_t head = *u->cq_head;
+
+    while (head != __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)) {
+        struct io_uring_cqe *cqe = &u->cqes[head & u->cq_mask];
+        uint64_t i = cqe->user_data;
+        int32_t res = cqe->res;
+        __atomic_store_n(u->cq_head, ++head, __ATOMIC_RELEASE);
+
+        uint64_t slot = i % AIO_SLOTS;
+        if (res < 0 || (res == 0 && q->write)) {
+            aio_ring_complete(q, i, true, true);
+            continue;
+        }
+        q->lens[slot] += res;
+        stats_add(q->write ? STAT_BYTES_OUT : STAT_BYTES_IN, res);
+        if (res > 0 && q->lens[slot] < q->wants[slot]) {
+            aio_uring_push(q, i);
+        } else {
+            aio_ring_complete(q, i, q->lens[slot] < q->wants[slot], false);
+        }
+    }
+}
+
+//Returns how many bytes stdio holds for file that have not been read yet, including any pushed back
+//with ungetc. These can be taken with fread without it going to the descriptor.
+static uint64_t aio_stream_buffered(FILE *file) {
+#ifdef __GLIBC__
+    uint64_t len = file->_IO_read_end - file->_IO_read_ptr;
+    if (file->_flags & 0x100) {
+        //_IO_IN_BACKUP: the pushed back bytes live in a separate area in front of the buffer
+        len += file->_IO_save_end - file->_IO_save_base;
+    }
+    return len;
+#else
+    return __freadahead(file);
+#endif
+}
+
+//Reads up to want bytes of a stream into buf. What stdio already buffered, for example behind a
+//header parsed with fscanf, comes first. After that the thread sleeps in poll until the descriptor
+//has data, which read(2) then takes without blocking, or until aio_reader_clear writes to the wake
+//pipe. The descriptor's flags are shared with other processes, so they are left alone.
+//Sets eof, error or stopped when it returns 0.
+static uint64_t aio_stream_read(
+    AIORing *q, uint8_t *buf, uint64_t want, bool *eof, bool *error, bool *stopped) {
+    StatTimer timer;
+
+    uint64_t buffered = aio_stream_buffered(q->file);
+    if (buffered > 0) {
+        return fread(buf, sizeof(uint8_t), buffered < want ? buffered : want, q->file);
+    }
+
+    while (true) {
+        struct pollfd fds[2] = { { q->fd, POLLIN, 0 }, { q->wake[0], POLLIN, 0 } };
+        int ready;
+        while ((ready = poll(fds, 2, -1)) < 0 && errno == EINTR) {
+        }
+        if (ready < 0) {
+            *error = true;
+            return 0;
+        }
+        if (fds[1].revents & POLLIN) {
+            *stopped = true;
+            return 0;
+        }
+
+        //POLLHUP and POLLERR are reported by read as the EOF or an error
+        stats_start(&timer);
+        ssize_t got = read(q->fd, buf, want);
+        int err = errno;
+        stats_stop(&timer, PHASE_IO);
+        if (got > 0) {
+            return got;
+        }
+        if (got == 0) {
+            *eof = true;
+            return 0;
+        }
+        if (err != EINTR && err != EAGAIN && err != EWOULDBLOCK) {
+            *error = true;
+            return 0;
+        }
+    }
+}
+
+//Moves request i between its slot and the file on a helper thread. Positional transfers loop until
+//the request is whole, so only the end of the file cuts a read short.
+static uint64_t aio_transfer(AIORing *q, uint64_t i, bool *last, bool *error, bool *stopped) {
+    StatTimer timer;
+    uint64_t slot = i % AIO_SLOTS;
+    uint8_t *buf = q->slots[slot];
+    uint64_t want = q->wants[slot];
+
+    if (q->backend == AIO_STREAM) {
+        if (!q->write) {
+            return aio_stream_read(q, buf, want, last, error, stopped);
+        }
+        stats_start(&timer);
+        uint64_t put = fwrite(buf, sizeof(uint8_t), want, q->file);
+        stats_stop(&timer, PHASE_IO);
+        *error = put < want;
+        return put;
+    }
+
+    uint64_t done = 0;
+    off_t offset = q->base + i * AIO_SLOT_SIZE;
+    stats_start(&timer);
+    while (done < want) {
+        ssize_t n = q->write ? pwrite(q->fd, buf + done, want - done, offset + done)
+                             : pread(q->fd, buf + done, want - done, offset + done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 || (n == 0 && q->write)) {
+            *error = true;
+            break;
+        }
+        if (n == 0) {
+            break;
+        }
+        done += n;
+    }
+    stats_stop(&timer, PHASE_IO);
+    *last = done < want;
+    return done;
+}
+
+//Helper threads take requests in order and complete them in whatever order their transfers finish.
+//A writer drops its remaining requests after a failure so the caller never blocks on them.
+static void *aio_ring_main(void *arg) {
+    AIORing *q = (AIORing *) arg;
+
+    while (true) {
+        pthread_mutex_lock(&q->lock);
+        while (q->next == q->tail && !q->stop) {
+            pthread_cond_wait(&q->cond, &q->lock);
+        }
+        if (q->stop) {
+            pthread_mutex_unlock(&q->lock);
+            break;
+        }
+        uint64_t i = q->next++;
+        bool skip = q->write && q->error;
+        pthread_mutex_unlock(&q->lock);
+
+        bool last = false, error = false, stopped = false;
+        uint64_t got = skip ? 0 : aio_transfer(q, i, &last, &error, &stopped);
+        if (stopped) {
+            break;
+        }
+        stats_add(q->write ? STAT_BYTES_OUT : STAT_BYTES_IN, got);
+
+        pthread_mutex_lock(&q->lock);
+        q->lens[i % AIO_SLOTS] = got;
+        aio_ring_complete(q, i, last, error);
+        pthread_cond_broadcast(&q->cond);
+        pthread_mutex_unlock(&q->lock);
+    }
+    return NULL;
+}
+
+//Picks a backend for file and starts its helper threads. Regular files are accessed at explicit
+//offsets from base, through io_uring when the kernel allows it, and anything else as a stream.
+static void aio_ring_init(AIORing *q, FILE *file, bool write) {
+    q->file = file;
+    q->fd = fileno(file);
+    q->flags = fcntl(q->fd, F_GETFL);
+    q->wake[0] = q->wake[1] = -1;
+    q->write = write;
+    q->head = 0;
+    q->tail = 0;
+    q->next = 0;
+    q->error = false;
+    q->stop = false;
+    for (int i = 0; i < AIO_SLOTS; i++) {
+        q->slots[i] = (uint8_t *) malloc(AIO_SLOT_SIZE);
+        q->wants[i] = 0;
+        q->lens[i] = 0;
+        q->ready[i] = false;
+        q->last[i] = false;
+    }
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->cond, NULL);
+
+    //Appends ignore the offset, so they stay in order on a stream
+    struct stat st;
+    off_t base = -1;
+    if (fstat(q->fd, &st) == 0 && S_ISREG(st.st_mode) && !(write && (q->flags & O_APPEND))) {
+        base = ftello(file);
+    }
+    if (base >= 0) {
+        q->base = base;
+        q->size = st.st_size;
+        q->backend = aio_uring_init(&q->uring) ? AIO_URING : AIO_PREAD;
+    } else {
+        q->backend = AIO_STREAM;
+    }
+
+    //A stream reader waits in poll on the wake pipe as well as the file, so aio_reader_clear can
+    //interrupt it
+    if (q->backend == AIO_STREAM && !write && pipe(q->wake) != 0) {
+        q->wake[0] = q->wake[1] = -1;
+    }
+
+    q->nthreads = q->backend == AIO_PREAD ? AIO_SLOTS : q->backend == AIO_STREAM ? 1 : 0;
+    for (int i = 0; i < q->nthreads; i++) {
+        pthread_create(&q->threads[i], NULL, aio_ring_main, q);
+    }
+}
+
+//Starts the next request on the slot at tail, asking for want bytes.
+static void aio_ring_submit(AIORing *q, uint64_t want) {
+    uint64_t i = q->tail;
+    uint64_t slot = i % AIO_SLOTS;
+
+    pthread_mutex_lock(&q->lock);
+    q->wants[slot] = want;
+    q->lens[slot] = 0;
+    q->ready[slot] = false;
+    q->last[slot] = false;
+    q->tail++;
+    pthread_cond_broadcast(&q->cond);
+    pthread_mutex_unlock(&q->lock);
+
+    if (q->backend == AIO_URING) {
+        aio_uring_push(q, i);
+    }
+}
+
+//Blocks until request i has finished. This is where the caller waits on the disk.
+static void aio_ring_wait(AIORing *q, uint64_t i) {
+    StatTimer timer;
+    uint64_t slot = i % AIO_SLOTS;
+
+    if (q->backend == AIO_URING) {
+        aio_uring_reap(q);
+        while (!q->ready[slot]) {
+            stats_start(&timer);
+            long got = syscall(__NR_io_uring_enter, q->uring.fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+            stats_stop(&timer, PHASE_IO_WAIT);
+            if (got < 0 && errno != EINTR) {
+                aio_ring_complete(q, i, true, true);
+                break;
+            }
+            aio_uring_reap(q);
+        }
+        return;
+    }
+
+    pthread_mutex_lock(&q->lock);
+    while (!q->ready[slot]) {
+        stats_start(&timer);
+        pthread_cond_wait(&q->cond, &q->lock);
+        stats_stop(&timer, PHASE_IO_WAIT);
+    }
+    pthread_mutex_unlock(&q->lock);
+}
+
+//Stops the ring once nothing in flight can still touch a slot, then frees it. Requests the helper
+//threads have not started yet are dropped, and a stream reader is woken out of poll.
+static void aio_ring_clear(AIORing *q) {
+    pthread_mutex_lock(&q->lock);
+    q->stop = true;
+    pthread_cond_broadcast(&q->cond);
+    pthread_mutex_unlock(&q->lock);
+    if (q->wake[1] >= 0) {
+        while (write(q->wake[1], "", 1) < 0 && errno == EINTR) {
+        }
+    }
+
+    for (int i = 0; i < q->nthreads; i++) {
+        pthread_join(q->threads[i], NULL);
+    }
+    if (q->backend == AIO_URING) {
+        for (uint64_t i = q->head; i < q->tail; i++) {
+            aio_ring_wait(q, i);
+        }
+        aio_uring_clear(&q->uring);
+    }
+    if (q->wake[0] >= 0) {
+        close(q->wake[0]);
+        close(q->wake[1]);
+    }
+
+    pthread_mutex_destroy(&q->lock);
+    pthread_cond_destroy(&q->cond);
+    for (int i = 0; i < AIO_SLOTS; i++) {
+        free(q->slots[i]);
+    }
+}
+
+//Reads at most limit bytes of file from its current position in the background, starting right away.
+void aio_reader_init(AIOReader *r, FILE *file, uint64_t limit) {
+    aio_ring_init(&r->ring, file, false);
+    r->pos = 0;
+    r->pending = 0;
+    r->total = 0;
+    r->eof = false;
+
+    //Positional reads never ask for anything past the end of the file
+    AIORing *q = &r->ring;
+    if (q->backend != AIO_STREAM) {
+        uint64_t left = q->size > q->base ? q->size - q->base : 0;
+        if (limit > left) {
+            limit = left;
+        }
+    }
+    r->limit = limit;
+}
+
+//Keeps every free slot busy with a request for the bytes that have not been asked for yet.
+static void aio_reader_submit(AIOReader *r) {
+    AIORing *q = &r->ring;
+
+    while (!r->eof && q->tail - q->head < AIO_SLOTS && r->limit > r->pending) {
+        uint64_t want = r->limit - r->pending;
+        if (want > AIO_SLOT_SIZE) {
+            want = AIO_SLOT_SIZE;
+        }
+        r->pending += want;
+        aio_ring_submit(q, want);
+    }
+}
+
+//Makes sure the slot at head has unread bytes. Returns false once everything has been read.
+static bool aio_reader_fill(AIOReader *r) {
+    AIORing *q = &r->ring;
+
+    while (true) {
+        aio_reader_submit(r);
+        if (q->head == q->tail) {
+            return false;
+        }
+        uint64_t slot = q->head % AIO_SLOTS;
+        aio_ring_wait(q, q->head);
+        if (r->pos < q->lens[slot]) {
+            return true;
+        }
+
+        //Retiring the drained request so its slot can be reused. A stream hands over whatever
+        //arrived, so only the end of the file or an error stops the reads.
+        r->pending -= q->wants[slot];
+        r->limit -= q->lens[slot];
+        r->eof = r->eof || q->last[slot];
+        q->head++;
+        r->pos = 0;
+        if (r->eof) {
+            return false;
+        }
+    }
+}
+
+//Copies the next len bytes into buf. Like fread, it only returns less than len at the end.
+uint64_t aio_read(AIOReader *r, uint8_t *buf, uint64_t len) {
+    AIORing *q = &r->ring;
+    uint64_t done = 0;
+
+    while (done < len && aio_reader_fill(r)) {
+        uint64_t slot = q->head % AIO_SLOTS;
+        uint64_t take = q->lens[slot] - r->pos;
+        if (take > len - done) {
+            take = len - done;
+        }
+        memcpy(buf + done, q->slots[slot] + r->pos, take);
+        r->pos += take;
+        done += take;
+    }
+    r->total += done;
+    return done;
+}
+
+//Reads the next line without its newline into line. Anything past cap - 1 characters is dropped
+//and fits is set to false. Returns false if nothing was left to read.
+bool aio_read_line(AIOReader *r, char *line, uint64_t cap, bool *fits) {
+    AIORing *q = &r->ring;
+    uint64_t len = 0;
+    bool found = false;
+    *fits = true;
+
+    while (aio_reader_fill(r)) {
+        found = true;
+        uint64_t slot = q->head % AIO_SLOTS;
+        uint8_t *start = q->slots[slot] + r->pos;
+        uint64_t avail = q->lens[slot] - r->pos;
+        uint8_t *newline = (uint8_t *) memchr(start, '\n', avail);
+        uint64_t take = newline != NULL ? (uint64_t) (newline - start) : avail;
+
+        uint64_t copy = take < cap - 1 - len ? take : cap - 1 - len;
+        *fits = *fits && copy == take;
+        memcpy(line + len, start, copy);
+        len += copy;
+
+        if (newline != NULL) {
+            r->pos += take + 1;
+            r->total += take + 1;
+            break;
+        }
+        r->pos += take;
+        r->total += take;
+    }
+    line[len] = '\0';
+    return found;
+}
+
+//Stops reading and frees the ring. Bytes read ahead but never used are dropped, and a regular file
+//is left positioned right after the last byte handed out. Returns false if reading the file failed.
+bool aio_reader_clear(AIOReader *r) {
+    AIORing *q = &r->ring;
+    bool error = q->error;
+    if (q->backend != AIO_STREAM) {
+        fseeko(q->file, q->base + r->total, SEEK_SET);
+    }
+    aio_ring_clear(q);
+    return !error;
+}
+
+//Writes to file from its current position. Anything stdio still buffers goes out first.
+void aio_writer_init(AIOWriter *w, FILE *file) {
+    fflush(file);
+    aio_ring_init(&w->ring, file, true);
+    w->fill = 0;
+    w->total = 0;
+}
+
+//Hands the slot being filled to the ring and, if every slot is now in flight, waits for the oldest.
+static void aio_writer_submit(AIOWriter *w) {
+    AIORing *q = &w->ring;
+
+    aio_ring_submit(q, w->fill);
+    w->fill = 0;
+    if (q->tail - q->head == AIO_SLOTS) {
+        aio_ring_wait(q, q->head);
+        q->head++;
+    }
+}
+
+//Copies len bytes from buf into the ring. They reach the file in order behind the caller.
+void aio_write(AIOWriter *w, const uint8_t *buf, uint64_t len) {
+    AIORing *q = &w->ring;
+
+    w->total += len;
+    while (len > 0) {
+        uint64_t slot = q->tail % AIO_SLOTS;
+        uint64_t take = AIO_SLOT_SIZE - w->fill;
+        if (take > len) {
+            take = len;
+        }
+        memcpy(q->slots[slot] + w->fill, buf, take);
+        w->fill += take;
+        buf += take;
+        len -= take;
+
+        if (w->fill == AIO_SLOT_SIZE) {
+            aio_writer_submit(w);
+        }
+    }
+}
+
+//Writes out everything still in the ring and stops it. A regular file is left positioned after
+//the written bytes and a stream is flushed. Returns false if any of it failed to reach the file.
+bool aio_writer_clear(AIOWriter *w) {
+    AIORing *q = &w->ring;
+
+    if (w->fill > 0) {
+        aio_ring_submit(q, w->fill);
+    }
+    while (q->head < q->tail) {
+        aio_ring_wait(q, q->head);
+        q->head++;
+    }
+    bool error = q->error;
+    aio_ring_clear(q);
+
+    if (q->backend != AIO_STREAM) {
+        error = fseeko(q->file, q->base + w->total, SEEK_SET) != 0 || error;
+    } else {
+        error = fflush(q->file) != 0 || error;
+    }
+    return !error;
+}
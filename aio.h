@@ -0,0 +1,96 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/uio.h>
+
+//Number of buffers in each ring and the size of each buffer (1 MiB).
+#define AIO_SLOTS     4
+#define AIO_SLOT_SIZE (1 << 20)
+
+//How a ring moves its buffers to and from the file.
+typedef enum AIOBackend {
+    AIO_URING, //io_uring with every slot in flight at once, driven by the caller's thread
+    AIO_PREAD, //pread or pwrite at explicit offsets from one thread per slot
+    AIO_STREAM, //fread or fwrite in order from a single thread, for pipes and terminals
+} AIOBackend;
+
+//An io_uring instance with its submission and completion queues mapped in.
+typedef struct AIOUring {
+    int fd;
+    uint8_t *sq;
+    uint64_t sq_len;
+    uint8_t *cq;
+    uint64_t cq_len;
+    struct io_uring_sqe *sqes;
+    uint64_t sqes_len;
+    uint32_t *sq_tail;
+    uint32_t *sq_array;
+    uint32_t sq_mask;
+    uint32_t *cq_head;
+    uint32_t *cq_tail;
+    uint32_t cq_mask;
+    struct io_uring_cqe *cqes;
+    struct iovec iovs[AIO_SLOTS];
+} AIOUring;
+
+//Request i of a ring lives in slot i % AIO_SLOTS. On a regular file it covers the bytes from
+//base + i * AIO_SLOT_SIZE, so every request but the last is a whole slot.
+typedef struct AIORing {
+    FILE *file;
+    int fd;
+    int flags;
+    int wake[2];
+    bool write;
+    AIOBackend backend;
+    AIOUring uring;
+    uint64_t base;
+    uint64_t size;
+    pthread_t threads[AIO_SLOTS];
+    int nthreads;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint8_t *slots[AIO_SLOTS];
+    uint64_t wants[AIO_SLOTS];
+    uint64_t lens[AIO_SLOTS];
+    bool ready[AIO_SLOTS];
+    bool last[AIO_SLOTS];
+    uint64_t head;
+    uint64_t tail;
+    uint64_t next;
+    bool error;
+    bool stop;
+} AIORing;
+
+//Reads ahead of the caller, keeping up to AIO_SLOTS requests in flight.
+typedef struct AIOReader {
+    AIORing ring;
+    uint64_t pos;
+    uint64_t limit;
+    uint64_t pending;
+    uint64_t total;
+    bool eof;
+} AIOReader;
+
+//Writes behind the caller, keeping up to AIO_SLOTS requests in flight.
+typedef struct AIOWriter {
+    AIORing ring;
+    uint64_t fill;
+    uint64_t total;
+} AIOWriter;
+
+void aio_reader_init(AIOReader *r, FILE *file, uint64_t limit);
+
+uint64_t aio_read(AIOReader *r, uint8_t *buf, uint64_t len);
+
+bool aio_read_line(AIOReader *r, char *line, uint64_t cap, bool *fits);
+
+bool aio_reader_clear(AIOReader *r);
+
+void aio_writer_init(AIOWriter *w, FILE *file);
+
+void aio_write(AIOWriter *w, const uint8_t *buf, uint64_t len);
+
+bool aio_writer_clear(AIOWriter *w);
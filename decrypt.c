@@ -1,16 +1,21 @@
 #include "rsa.h"
 #include "numtheory.h"
 #include "randstate.h"
+#include "stats.h"
 
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <getopt.h>
+#include <string.h>
 #include <inttypes.h>
 #include <stdbool.h>
 #include <time.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
 #include <gmp.h>
 
 /****************************************************/
@@ -20,6 +25,11 @@
 
 void help(); //Declaration for the help function.
 
+bool decrypt_manifest(FILE *manifest, char *in_path, FILE *outfile, mpz_t n, mpz_t d,
+    uint64_t count, uint64_t total); //Declaration for the manifest decryption function.
+
+static struct option long_options[] = { STATS_LONG_OPTION, { 0, 0, 0, 0 } };
+
 int main(int argc, char **argv) {
 
     //Creating variables needed for encrypt
@@ -27,13 +37,16 @@ int main(int argc, char **argv) {
     mpz_t n, d;
     mpz_inits(n, d, NULL);
     bool verbose = false;
+    bool stats = false;
+    bool stats_json = false;
+    char *in_path = NULL;
     FILE *infile = stdin; //The infile responsble for being the input file. Set to stdin by default.
     FILE *outfile
         = stdout; //The outfile is responsible for being the output file. Set to stdout by default.
     char *pub = "rsa.priv";
 
     //This while loop is responsible for parsing through the command-lines given by a user.
-    while ((opt = getopt(argc, argv, "i:o:n:vh")) != -1) {
+    while ((opt = getopt_long(argc, argv, "i:o:n:vh", long_options, NULL)) != -1) {
 
         //This if statement is responsible for printing out the help statement if the user inputs an unknown command-line.
         if (opt == '?') {
@@ -46,12 +59,24 @@ int main(int argc, char **argv) {
         //This are all the cases.
         switch (opt) {
         case 'v': verbose = true; break;
+        case 'S':
+            stats = true;
+            if (!stats_parse_arg(optarg, &stats_json)) {
+                help();
+                fclose(infile);
+                fclose(outfile);
+                return -1;
+            }
+            break;
         case 'h':
             help();
             fclose(infile);
             fclose(outfile);
             return -1;
-        case 'i': infile = fopen(optarg, "r"); break;
+        case 'i':
+            in_path = optarg;
+            infile = fopen(optarg, "r");
+            break;
         case 'o': outfile = fopen(optarg, "w"); break;
         case 'n': pub = optarg;
         }
@@ -70,12 +95,87 @@ int main(int argc, char **argv) {
         gmp_printf("e (%zu bits) = %Zd\n", mpz_sizeinbase(d, 2), d);
     }
 
-    rsa_decrypt_file(infile, outfile, n, d);
+    //Decompression and segment headers are detected from the data itself, and a manifest
+    //reassembles its segments in order
+    bool ok;
+    uint64_t count, length;
+    if (rsa_is_manifest(infile)) {
+        ok = rsa_read_manifest(infile, &count, &length);
+        if (!ok) {
+            fprintf(stderr, "Error, manifest header is malformed.\n");
+        } else {
+            ok = decrypt_manifest(infile, in_path, outfile, n, d, count, length);
+        }
+    } else {
+        ok = rsa_decrypt_file(infile, outfile, n, d, NULL);
+        if (!ok) {
+            fprintf(stderr, "Error, encrypted data is corrupt or failed to read or write.\n");
+        }
+    }
+
+    //Prints out the instrumentation if indicated by user.
+    if (stats) {
+        stats_print(stderr, stats_json);
+    }
 
     mpz_clears(n, d, NULL);
     fclose(infile);
     fclose(outfile);
     fclose(pvfile);
+    return ok ? 0 : 1;
+}
+
+//Decrypts the count segments listed in manifest into outfile in order. Segment names are
+//relative to the directory holding the manifest. Each segment has to start where the previous
+//one ended and hold the bytes its header promises, and together they have to add up to total.
+bool decrypt_manifest(FILE *manifest, char *in_path, FILE *outfile, mpz_t n, mpz_t d,
+    uint64_t count, uint64_t total) {
+
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s", in_path != NULL ? in_path : "./manifest");
+    char *base_dir = dirname(dir);
+
+    uint64_t done = 0;
+    for (uint64_t i = 0; i < count; i++) {
+        char name[PATH_MAX], path[2 * PATH_MAX];
+        if (fgets(name, sizeof(name), manifest) == NULL) {
+            fprintf(stderr, "Error, manifest lists fewer segments than expected.\n");
+            return false;
+        }
+        name[strcspn(name, "\n")] = '\0';
+        snprintf(path, sizeof(path), "%s/%s", base_dir, name);
+
+        FILE *segment = fopen(path, "r");
+        if (segment == NULL) {
+            fprintf(stderr, "Error, failed to open segment %s.\n", path);
+            return false;
+        }
+
+        //Making sure the segments are reassembled in the order they were split
+        uint64_t index, shards, offset, length;
+        if (!rsa_is_shard(segment) || !rsa_read_shard(segment, &index, &shards, &offset, &length)
+            || index != i || shards != count || offset != done) {
+            fprintf(stderr, "Error, %s is not segment %" PRIu64 " of the manifest.\n", path, i);
+            fclose(segment);
+            return false;
+        }
+
+        uint64_t written;
+        bool ok = rsa_decrypt_file(segment, outfile, n, d, &written);
+        fclose(segment);
+        if (!ok || written != length) {
+            fprintf(stderr, "Error, encrypted data in %s is corrupt or failed to read or write.\n",
+                path);
+            return false;
+        }
+        done += written;
+    }
+    if (done != total) {
+        fprintf(stderr, "Error, segments hold %" PRIu64 " bytes but the manifest lists %" PRIu64 ".\n",
+            done, total);
+        return false;
+    }
+    return true;
 }
 
 //Helper function that prints out the help statement.
@@ -89,7 +189,8 @@ void help() {
     printf("\n");
     printf("OPTIONS\n");
     printf("   -h              Display program help and usage.\n");
-    printf("   -v              Display verbose program output.");
+    printf("   -v              Display verbose program output.\n");
+    printf("   --stats[=json]  Print operation counters and phase timings to stderr.\n");
     printf("   -i infile       Input file of data to encrypt (default: stdin).\n");
     printf("   -o outfile      Output file for encrypted data (default: stdout).\n");
     printf("   -n pbfile       Public key file (default: rsa.pub).\n");
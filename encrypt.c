@@ -1,16 +1,22 @@
 #include "rsa.h"
 #include "numtheory.h"
 #include "randstate.h"
+#include "stats.h"
 
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <getopt.h>
+#include <string.h>
 #include <inttypes.h>
 #include <stdbool.h>
 #include <time.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <sys/wait.h>
 #include <gmp.h>
 
 /****************************************************/
@@ -20,6 +26,13 @@
 
 void help(); //Declaration for the help function.
 
+bool encrypt_shards(char *in_path, char *out_path, FILE *manifest, mpz_t n, mpz_t e, bool compress,
+    uint64_t shards); //Declaration for the sharded encryption function.
+
+//--stats[=json] prints instrumentation to stderr on exit and --shards N splits the output into N segments.
+static struct option long_options[] = { STATS_LONG_OPTION,
+    { "shards", required_argument, NULL, 'x' }, { 0, 0, 0, 0 } };
+
 int main(int argc, char **argv) {
 
     //Creating variables needed for encrypt
@@ -28,13 +41,20 @@ int main(int argc, char **argv) {
     mpz_inits(n, e, s, username_mpz, NULL);
     char username[32];
     bool verbose = false;
+    bool stats = false;
+    bool stats_json = false;
+    bool compress = false;
+    uint64_t shards = 0;
+    char *end;
+    char *in_path = NULL;
+    char *out_path = NULL;
     FILE *infile = stdin; //The infile responsble for being the input file. Set to stdin by default.
     FILE *outfile
         = stdout; //The outfile is responsible for being the output file. Set to stdout by default.
     char *pub = "rsa.pub";
 
     //This while loop is responsible for parsing through the command-lines given by a user.
-    while ((opt = getopt(argc, argv, "i:o:n:vh")) != -1) {
+    while ((opt = getopt_long(argc, argv, "i:o:n:zvh", long_options, NULL)) != -1) {
 
         //This if statement is responsible for printing out the help statement if the user inputs an unknown command-line.
         if (opt == '?') {
@@ -47,13 +67,40 @@ int main(int argc, char **argv) {
         //This are all the cases.
         switch (opt) {
         case 'v': verbose = true; break;
+        case 'S':
+            stats = true;
+            if (!stats_parse_arg(optarg, &stats_json)) {
+                help();
+                fclose(infile);
+                fclose(outfile);
+                return -1;
+            }
+            break;
+        case 'z': compress = true; break;
+        case 'x':
+            //Only a plain positive number of shards is accepted
+            shards = strtoull(optarg, &end, 10);
+            if (optarg[0] < '0' || optarg[0] > '9' || *end != '\0' || shards == 0) {
+                printf("Error, --shards needs a positive number.\n");
+                help();
+                fclose(infile);
+                fclose(outfile);
+                return -1;
+            }
+            break;
         case 'h':
             help();
             fclose(infile);
             fclose(outfile);
             return -1;
-        case 'i': infile = fopen(optarg, "r"); break;
-        case 'o': outfile = fopen(optarg, "w"); break;
+        case 'i':
+            in_path = optarg;
+            infile = fopen(optarg, "r");
+            break;
+        case 'o':
+            out_path = optarg;
+            outfile = fopen(optarg, "w");
+            break;
         case 'n': pub = optarg;
         }
     }
@@ -75,12 +122,143 @@ int main(int argc, char **argv) {
 
     mpz_set_str(username_mpz, username, 0);
 
-    rsa_encrypt_file(infile, outfile, n, e);
+    //Sharding needs named files, since every worker reopens the input and writes its own segment.
+    bool ok = true;
+    if (shards > 0) {
+        if (in_path == NULL || out_path == NULL) {
+            printf("Error, --shards needs both -i infile and -o outfile.\n");
+            return 1;
+        }
+
+        //The workers are separate processes, so their counters have to be shared before forking
+        if (stats && !stats_share()) {
+            fprintf(stderr, "Warning, --stats cannot include the work done by shard workers.\n");
+        }
+        ok = encrypt_shards(in_path, out_path, outfile, n, e, compress, shards);
+    } else {
+        ok = rsa_encrypt_file(infile, outfile, n, e, compress);
+        if (!ok) {
+            printf("Error, failed to read input or write output.\n");
+        }
+    }
+
+    //Prints out the instrumentation if indicated by user.
+    if (stats) {
+        stats_print(stderr, stats_json);
+    }
 
     mpz_clears(n, e, s, username_mpz, NULL);
     fclose(infile);
     fclose(outfile);
     fclose(pbfile);
+    return ok ? 0 : 1;
+}
+
+//Encrypts shard index of shards into out_path.index. Runs in a forked worker and never returns.
+static void encrypt_shard_worker(char *in_path, char *out_path, mpz_t n, mpz_t e, bool compress,
+    uint64_t index, uint64_t shards, uint64_t offset, uint64_t length) {
+
+    char name[PATH_MAX];
+    snprintf(name, sizeof(name), "%s.%" PRIu64, out_path, index);
+    FILE *shard_in = fopen(in_path, "r");
+    FILE *shard_out = fopen(name, "w");
+    if (shard_in == NULL || shard_out == NULL) {
+        printf("Error, failed to open %s.\n", shard_in == NULL ? in_path : name);
+        _exit(1);
+    }
+    bool ok = rsa_encrypt_shard(shard_in, shard_out, n, e, compress, index, shards, offset, length);
+    fclose(shard_in);
+    if (fclose(shard_out) != 0 || !ok) {
+        printf("Error, failed to read input or write %s.\n", name);
+        _exit(1);
+    }
+    _exit(0);
+}
+
+//Splits in_path at block boundaries into at most shards segments named out_path.0, out_path.1, ...
+//and encrypts each one in its own process, with no more processes running at once than there are
+//CPUs. The manifest listing the segments in order is written last.
+bool encrypt_shards(char *in_path, char *out_path, FILE *manifest, mpz_t n, mpz_t e, bool compress,
+    uint64_t shards) {
+
+    struct stat st;
+    if (stat(in_path, &st) != 0) {
+        printf("Error, failed to stat input file.\n");
+        return false;
+    }
+    uint64_t size = st.st_size;
+
+    //There are never more shards than k-1 byte blocks, so every shard gets at least one
+    uint64_t k = (mpz_sizeinbase(n, 2) - 1) / 8;
+    uint64_t blocks = (size + k - 2) / (k - 1);
+    if (shards > blocks) {
+        shards = blocks > 0 ? blocks : 1;
+    }
+
+    //Spreading the blocks evenly, with the first blocks % shards shards taking one extra
+    uint64_t per_shard = blocks / shards, extra = blocks % shards;
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    uint64_t max_workers = cpus > 0 ? (uint64_t) cpus : 1;
+
+    //Nothing buffered may be duplicated into the children
+    fflush(NULL);
+
+    //Keeping at most max_workers running, and after a failure only reaping the ones already started
+    bool ok = true;
+    uint64_t next = 0, running = 0;
+    while (running > 0 || (ok && next < shards)) {
+        if (ok && next < shards && running < max_workers) {
+            uint64_t first = next * per_shard + (next < extra ? next : extra);
+            uint64_t count = per_shard + (next < extra ? 1 : 0);
+            uint64_t offset = first * (k - 1);
+            uint64_t length = count * (k - 1);
+            if (offset > size) {
+                offset = size;
+            }
+            if (length > size - offset) {
+                length = size - offset;
+            }
+
+            pid_t pid = fork();
+            if (pid < 0) {
+                printf("Error, failed to start a shard worker.\n");
+                ok = false;
+                continue;
+            }
+            if (pid == 0) {
+                encrypt_shard_worker(
+                    in_path, out_path, n, e, compress, next, shards, offset, length);
+            }
+            next++;
+            running++;
+            continue;
+        }
+
+        int status;
+        if (wait(&status) < 0) {
+            ok = false;
+            break;
+        }
+        running--;
+        ok = ok && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    }
+    if (!ok) {
+        printf("Error, a shard failed to encrypt.\n");
+        return false;
+    }
+
+    //Segment names are stored relative to the manifest so the set can be moved together
+    rsa_write_manifest(manifest, shards, size);
+    char *base = basename(out_path);
+    for (uint64_t i = 0; i < shards; i++) {
+        fprintf(manifest, "%s.%" PRIu64 "\n", base, i);
+    }
+    if (fflush(manifest) != 0) {
+        printf("Error, failed to write the manifest.\n");
+        return false;
+    }
+    return true;
 }
 
 //Helper function that prints out the help statement.
@@ -90,11 +268,15 @@ void help() {
     printf("   Encrypted data is decrypted by the decrypt program.\n");
     printf("\n");
     printf("USAGE\n");
-    printf("   ./encrypt [-hv] [-i infile] [-o outfile] -n pubkey -d privkey\n");
+    printf("   ./encrypt [-hvz] [--shards N] [-i infile] [-o outfile] -n pubkey -d privkey\n");
     printf("\n");
     printf("OPTIONS\n");
     printf("   -h              Display program help and usage.\n");
-    printf("   -v              Display verbose program output.");
+    printf("   -v              Display verbose program output.\n");
+    printf("   --stats[=json]  Print operation counters and phase timings to stderr.\n");
+    printf("   -z              Compress data before encrypting it.\n");
+    printf("   --shards N      Encrypt into up to N independently decryptable segments named\n");
+    printf("                   outfile.0, outfile.1, ... and write a manifest to outfile.\n");
     printf("   -i infile       Input file of data to encrypt (default: stdin).\n");
     printf("   -o outfile      Output file for encrypted data (default: stdout).\n");
     printf("   -n pbfile       Public key file (default: rsa.pub).\n");
@@ -1,11 +1,14 @@
 #include "rsa.h"
 #include "numtheory.h"
 #include "randstate.h"
+#include "stats.h"
 
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <getopt.h>
+#include <string.h>
 #include <inttypes.h>
 #include <stdbool.h>
 #include <time.h>
@@ -20,6 +23,8 @@
 
 void help(); //Declaration for the help function.
 
+static struct option long_options[] = { STATS_LONG_OPTION, { 0, 0, 0, 0 } };
+
 int main(int argc, char **argv) {
 
     //Creating variables needed for keygen
@@ -31,9 +36,11 @@ int main(int argc, char **argv) {
     uint64_t seed = (uint64_t) time(NULL);
     char *username = getenv("USER");
     bool verbose = false;
+    bool stats = false;
+    bool stats_json = false;
 
     //This while loop is responsible for parsing through the command-lines given by a user.
-    while ((opt = getopt(argc, argv, "b:i:n:d:s:vh")) != -1) {
+    while ((opt = getopt_long(argc, argv, "b:i:n:d:s:vh", long_options, NULL)) != -1) {
 
         //This if statement is responsible for printing out the help statement if the user inputs an unknown command-line.
         if (opt == '?') {
@@ -46,6 +53,15 @@ int main(int argc, char **argv) {
         //This are all the cases.
         switch (opt) {
         case 'v': verbose = true; break;
+        case 'S':
+            stats = true;
+            if (!stats_parse_arg(optarg, &stats_json)) {
+                help();
+                fclose(pbfile);
+                fclose(pvfile);
+                return -1;
+            }
+            break;
         case 'h':
             help();
             fclose(pbfile);
@@ -96,6 +112,11 @@ int main(int argc, char **argv) {
         gmp_printf("d (%zu bits) = %Zd\n", mpz_sizeinbase(d, 2), d);
     }
 
+    //Prints out the instrumentation if indicated by user.
+    if (stats) {
+        stats_print(stderr, stats_json);
+    }
+
     //Clearing all memory.
     mpz_clears(p, q, n, e, d, s, username_mpz, NULL);
     randstate_clear();
@@ -113,7 +134,8 @@ void help() {
     printf("\n");
     printf("OPTIONS\n");
     printf("   -h              Display program help and usage.\n");
-    printf("   -v              Display verbose program output.");
+    printf("   -v              Display verbose program output.\n");
+    printf("   --stats[=json]  Print operation counters and phase timings to stderr.\n");
     printf("   -b bits         Minimum bits needed for public key n\n");
     printf("   -c confidence   Miller-Rabin iterations for testing primes (default: 50).\n");
     printf("   -n pbfile       Public key file (default: rsa.pub).\n");
@@ -0,0 +1,256 @@
+#include "lz.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+//Shortest match worth encoding, since a match costs a token plus a two byte offset.
+#define LZ_MIN_MATCH 4
+
+//Matches may not start in the last LZ_MF_LIMIT bytes or run into the last LZ_LAST_LITERALS bytes.
+#define LZ_MF_LIMIT      12
+#define LZ_LAST_LITERALS 5
+
+//Largest distance a match can reach back.
+#define LZ_MAX_OFFSET 65535
+
+#define LZ_HASH_BITS 12
+
+static inline uint32_t read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t get_be32(const uint8_t *p) {
+    return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+}
+
+static inline void put_be32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t) (v >> 24);
+    p[1] = (uint8_t) (v >> 16);
+    p[2] = (uint8_t) (v >> 8);
+    p[3] = (uint8_t) v;
+}
+
+static inline uint32_t lz_hash(uint32_t v) {
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+//Writes the part of a length that did not fit in its 4-bit token field.
+static uint8_t *lz_write_length(uint8_t *op, uint64_t len) {
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (uint8_t) len;
+    return op;
+}
+
+//Reads the part of a length that did not fit in its 4-bit token field.
+static bool lz_read_length(const uint8_t **ip, const uint8_t *iend, uint64_t *len) {
+    uint8_t b;
+    do {
+        if (*ip >= iend) {
+            return false;
+        }
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return true;
+}
+
+//Writes one sequence: a token, lit literal bytes from anchor and, if mlen is non-zero, a match.
+static uint8_t *lz_write_sequence(
+    uint8_t *op, const uint8_t *anchor, uint64_t lit, uint64_t offset, uint64_t mlen) {
+    uint8_t *token = op++;
+    uint64_t mcode = mlen > 0 ? mlen - LZ_MIN_MATCH : 0;
+
+    *token = (uint8_t) (((lit >= 15 ? 15 : lit) << 4) | (mcode >= 15 ? 15 : mcode));
+    if (lit >= 15) {
+        op = lz_write_length(op, lit - 15);
+    }
+    memcpy(op, anchor, lit);
+    op += lit;
+
+    if (mlen > 0) {
+        *op++ = (uint8_t) offset;
+        *op++ = (uint8_t) (offset >> 8);
+        if (mcode >= 15) {
+            op = lz_write_length(op, mcode - 15);
+        }
+    }
+    return op;
+}
+
+//Compresses src into dst using an LZ4-style greedy matcher and returns the compressed size.
+//dst must hold at least LZ_BOUND(src_len) bytes.
+uint64_t lz_compress(const uint8_t *src, uint64_t src_len, uint8_t *dst) {
+    uint32_t table[1 << LZ_HASH_BITS];
+    const uint8_t *ip = src;
+    const uint8_t *anchor = src;
+    const uint8_t *end = src + src_len;
+    uint8_t *op = dst;
+
+    if (src_len >= LZ_MF_LIMIT) {
+        const uint8_t *limit = end - LZ_MF_LIMIT;
+        const uint8_t *match_limit = end - LZ_LAST_LITERALS;
+        uint64_t misses = 0;
+
+        memset(table, 0, sizeof(table));
+        while (ip <= limit) {
+            uint32_t h = lz_hash(read32(ip));
+            const uint8_t *ref = src + table[h];
+            table[h] = (uint32_t) (ip - src);
+
+            //Skipping ahead faster the longer we go without finding a match
+            if (ref >= ip || ip - ref > LZ_MAX_OFFSET || read32(ref) != read32(ip)) {
+                ip += 1 + (misses++ >> 6);
+                continue;
+            }
+            misses = 0;
+
+            //Extending the match as far as it goes
+            uint64_t mlen = LZ_MIN_MATCH;
+            while (ip + mlen < match_limit && ref[mlen] == ip[mlen]) {
+                mlen++;
+            }
+
+            op = lz_write_sequence(op, anchor, ip - anchor, ip - ref, mlen);
+            ip += mlen;
+            anchor = ip;
+        }
+    }
+
+    //The remaining bytes are written as literals
+    op = lz_write_sequence(op, anchor, end - anchor, 0, 0);
+    return op - dst;
+}
+
+//Decompresses exactly dst_len bytes from src into dst. Returns false if src is malformed.
+bool lz_decompress(const uint8_t *src, uint64_t src_len, uint8_t *dst, uint64_t dst_len) {
+    const uint8_t *ip = src;
+    const uint8_t *iend = src + src_len;
+    uint8_t *op = dst;
+    uint8_t *oend = dst + dst_len;
+
+    while (ip < iend) {
+        uint8_t token = *ip++;
+
+        //Copying the literals
+        uint64_t lit = token >> 4;
+        if (lit == 15 && !lz_read_length(&ip, iend, &lit)) {
+            return false;
+        }
+        if (lit > (uint64_t) (iend - ip) || lit > (uint64_t) (oend - op)) {
+            return false;
+        }
+        memcpy(op, ip, lit);
+        op += lit;
+        ip += lit;
+
+        //The last sequence has no match
+        if (ip == iend) {
+            break;
+        }
+
+        //Copying the match byte by byte, since it may overlap itself
+        if (iend - ip < 2) {
+            return false;
+        }
+        uint64_t offset = ip[0] | ((uint64_t) ip[1] << 8);
+        ip += 2;
+        uint64_t mlen = token & 15;
+        if (mlen == 15 && !lz_read_length(&ip, iend, &mlen)) {
+            return false;
+        }
+        mlen += LZ_MIN_MATCH;
+        if (offset == 0 || offset > (uint64_t) (op - dst) || mlen > (uint64_t) (oend - op)) {
+            return false;
+        }
+        const uint8_t *ref = op - offset;
+        for (uint64_t i = 0; i < mlen; i++) {
+            op[i] = ref[i];
+        }
+        op += mlen;
+    }
+    return op == oend;
+}
+
+//Writes src as one frame (header followed by compressed or, if that is no smaller, raw bytes).
+//frame must hold at least LZ_HEADER_SIZE + LZ_BOUND(src_len) bytes. Returns the frame size.
+uint64_t lz_frame(const uint8_t *src, uint64_t src_len, uint8_t *frame) {
+    uint64_t stored = lz_compress(src, src_len, frame + LZ_HEADER_SIZE);
+
+    //A stored length equal to the raw length marks an uncompressed frame
+    if (stored >= src_len) {
+        memcpy(frame + LZ_HEADER_SIZE, src, src_len);
+        stored = src_len;
+    }
+    put_be32(frame, (uint32_t) src_len);
+    put_be32(frame + 4, (uint32_t) stored);
+    return LZ_HEADER_SIZE + stored;
+}
+
+void lz_stream_init(LZStream *s) {
+    s->buf = NULL;
+    s->len = 0;
+    s->cap = 0;
+    s->out = (uint8_t *) malloc(LZ_FRAME_SIZE);
+}
+
+//Buffers len bytes of framed data and writes out every frame that is now complete.
+//Returns false if a frame is malformed.
+bool lz_stream_feed(LZStream *s, const uint8_t *data, uint64_t len, AIOWriter *out) {
+
+    //Growing the buffer if needed
+    if (s->len + len > s->cap) {
+        uint64_t cap = s->cap > 0 ? 2 * s->cap : LZ_HEADER_SIZE + LZ_BOUND(LZ_FRAME_SIZE);
+        while (cap < s->len + len) {
+            cap *= 2;
+        }
+        s->buf = (uint8_t *) realloc(s->buf, cap);
+        s->cap = cap;
+    }
+    memcpy(s->buf + s->len, data, len);
+    s->len += len;
+
+    uint64_t pos = 0;
+    while (s->len - pos >= LZ_HEADER_SIZE) {
+        uint64_t raw = get_be32(s->buf + pos);
+        uint64_t stored = get_be32(s->buf + pos + 4);
+        if (raw == 0 || raw > LZ_FRAME_SIZE || stored > LZ_BOUND(raw)) {
+            return false;
+        }
+        if (s->len - pos - LZ_HEADER_SIZE < stored) {
+            break;
+        }
+
+        const uint8_t *body = s->buf + pos + LZ_HEADER_SIZE;
+        if (stored != raw) {
+            if (!lz_decompress(body, stored, s->out, raw)) {
+                return false;
+            }
+            body = s->out;
+        }
+        aio_write(out, body, raw);
+        pos += LZ_HEADER_SIZE + stored;
+    }
+
+    //Keeping the incomplete frame at the front of the buffer
+    memmove(s->buf, s->buf + pos, s->len - pos);
+    s->len -= pos;
+    return true;
+}
+
+//Returns true if the stream ended on a frame boundary.
+bool lz_stream_done(LZStream *s) {
+    return s->len == 0;
+}
+
+void lz_stream_clear(LZStream *s) {
+    free(s->buf);
+    free(s->out);
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "aio.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+//Amount of plaintext compressed as one independent frame.
+#define LZ_FRAME_SIZE (1 << 16)
+
+//Bytes in a frame header (raw length and stored length, both 32-bit big-endian).
+#define LZ_HEADER_SIZE 8
+
+//Worst case size of a compressed block of n bytes.
+#define LZ_BOUND(n) ((n) + (n) / 255 + 16)
+
+typedef struct LZStream {
+    uint8_t *buf;
+    uint64_t len;
+    uint64_t cap;
+    uint8_t *out;
+} LZStream;
+
+uint64_t lz_compress(const uint8_t *src, uint64_t src_len, uint8_t *dst);
+
+bool lz_decompress(const uint8_t *src, uint64_t src_len, uint8_t *dst, uint64_t dst_len);
+
+uint64_t lz_frame(const uint8_t *src, uint64_t src_len, uint8_t *frame);
+
+void lz_stream_init(LZStream *s);
+
+bool lz_stream_feed(LZStream *s, const uint8_t *data, uint64_t len, AIOWriter *out);
+
+bool lz_stream_done(LZStream *s);
+
+void lz_stream_clear(LZStream *s);
@@ -1,6 +1,8 @@
 #include "numtheory.h"
 #include "randstate.h"
+#include "stats.h"
 
+#include <stdlib.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -76,35 +78,110 @@ void mod_inverse(mpz_t o, mpz_t a, mpz_t n) {
     mpz_clears(r, r_prime, t, t_prime, r_temp, t_temp, q_temp, q, NULL);
 }
 
-//Performs modular exponjentiation and stores it into o.
-void pow_mod(mpz_t o, mpz_t a, mpz_t d, mpz_t n) {
+//Recodes d into sliding-window digits so exponentiation never has to shift d. Wider windows mean
+//fewer multiplies but a bigger table of odd powers, so the width grows with the size of d.
+void pow_exp_init(PowExp *x, mpz_t d) {
+
+    uint64_t bits = mpz_cmp_ui(d, 0) > 0 ? mpz_sizeinbase(d, 2) : 0;
+    x->width = bits < 24 ? 1 : bits < 80 ? 3 : bits < 240 ? 4 : bits < 672 ? 5 : 6;
+    x->len = bits;
+    x->digits = (uint8_t *) calloc(bits > 0 ? bits : 1, sizeof(uint8_t));
+
+    //Scanning d from the top bit down
+    uint64_t pos = 0;
+    int64_t i = (int64_t) bits - 1;
+    while (i >= 0) {
+        //A zero bit is just a squaring
+        if (mpz_tstbit(d, i) == 0) {
+            x->digits[pos++] = 0;
+            i--;
+            continue;
+        }
 
-    //Creating a variable p and setting it to a and a variable v and setting it to 1 (Also a temp variables for d and n)
-    mpz_t p, v, d_temp, n_temp;
-    mpz_inits(p, v, d_temp, n_temp, NULL);
-    mpz_set(p, a);
-    mpz_set(d_temp, d);
-    mpz_set(n_temp, n);
-    mpz_set_ui(v, 1);
+        //Taking the longest window of at most width bits that starts at i and ends on a one bit
+        int64_t j = i - (int64_t) x->width + 1;
+        if (j < 0) {
+            j = 0;
+        }
+        while (mpz_tstbit(d, j) == 0) {
+            j++;
+        }
+        uint8_t u = 0;
+        for (int64_t b = i; b >= j; b--) {
+            u = (uint8_t) ((u << 1) | mpz_tstbit(d, b));
+        }
 
-    //While d is greater than 0
-    while (mpz_cmp_ui(d_temp, 0) > 0) {
-        //If d is odd
-        if (mpz_odd_p(d_temp) != 0) {
-            //Sets v to (v * p) % n
-            mpz_mul(v, v, p);
-            mpz_mod(v, v, n_temp);
-            mpz_set(o, v);
+        //The window is squared in bit by bit and multiplied in once at its last bit
+        for (int64_t b = i; b > j; b--) {
+            x->digits[pos++] = 0;
         }
-        //Sets p to (p *p) % n
-        mpz_mul(p, p, p);
-        mpz_mod(p, p, n_temp);
+        x->digits[pos++] = u;
+        i = j - 1;
+    }
+}
+
+void pow_exp_clear(PowExp *x) {
+    free(x->digits);
+}
+
+//Performs modular exponentiation with a recoded exponent and stores it into o.
+void pow_mod_exp(mpz_t o, mpz_t a, PowExp *x, mpz_t n) {
+
+    stats_add(STAT_POW_MOD_CALLS, 1);
+    stats_add(STAT_POW_MOD_BITS, x->len);
+
+    //Precomputing the odd powers a, a^3, a^5, ... that the digits can ask for
+    uint64_t count = (uint64_t) 1 << (x->width - 1);
+    mpz_t *table = (mpz_t *) malloc(count * sizeof(mpz_t));
+    mpz_t v, a_squared;
+    mpz_inits(v, a_squared, NULL);
 
-        //Sets d to d/2
-        mpz_fdiv_q_ui(d_temp, d_temp, 2);
+    mpz_init(table[0]);
+    mpz_mod(table[0], a, n);
+    if (count > 1) {
+        mpz_mul(a_squared, table[0], table[0]);
+        mpz_mod(a_squared, a_squared, n);
     }
+    for (uint64_t i = 1; i < count; i++) {
+        mpz_init(table[i]);
+        mpz_mul(table[i], table[i - 1], a_squared);
+        mpz_mod(table[i], table[i], n);
+    }
+
+    //Walking the digits, skipping the squarings of v while it is still 1
+    bool one = true;
+    mpz_set_ui(v, 1);
+    for (uint64_t i = 0; i < x->len; i++) {
+        if (!one) {
+            mpz_mul(v, v, v);
+            mpz_mod(v, v, n);
+        }
+        uint8_t digit = x->digits[i];
+        if (digit != 0) {
+            if (one) {
+                mpz_set(v, table[digit >> 1]);
+                one = false;
+            } else {
+                mpz_mul(v, v, table[digit >> 1]);
+                mpz_mod(v, v, n);
+            }
+        }
+    }
+    mpz_mod(o, v, n);
 
-    mpz_clears(p, v, d_temp, n_temp, NULL);
+    for (uint64_t i = 0; i < count; i++) {
+        mpz_clear(table[i]);
+    }
+    free(table);
+    mpz_clears(v, a_squared, NULL);
+}
+
+//Performs modular exponjentiation and stores it into o.
+void pow_mod(mpz_t o, mpz_t a, mpz_t d, mpz_t n) {
+    PowExp x;
+    pow_exp_init(&x, d);
+    pow_mod_exp(o, a, &x, n);
+    pow_exp_clear(&x);
 }
 
 //This function implements the Miller-Rabin primality test to deterministically tests for a prime number.
@@ -117,6 +194,7 @@ bool is_prime(mpz_t n, uint64_t iters) {
 
     //If n is 1 or n is even, return false
     if (mpz_cmp_ui(n, 1) == 0 || mpz_even_p(n) != 0) {
+        stats_add(STAT_TRIVIAL_REJECTS, 1);
         return false;
     }
 
@@ -150,6 +228,8 @@ bool is_prime(mpz_t n, uint64_t iters) {
 
     //for iters amount of time
     for (uint64_t i = 1; i < iters; i++) {
+        stats_add(STAT_MR_ROUNDS, 1);
+
         //Setting a to a random number
         mpz_urandomm(a, state, n_minus_three);
 
@@ -193,7 +273,9 @@ bool is_prime(mpz_t n, uint64_t iters) {
 void make_prime(mpz_t p, uint64_t bits, uint64_t iters) {
 
     mpz_urandomb(p, state, bits);
+    stats_add(STAT_CANDIDATES, 1);
     while (!(is_prime(p, iters)) || mpz_sizeinbase(p, 2) < bits) {
         mpz_urandomb(p, state, bits);
+        stats_add(STAT_CANDIDATES, 1);
     }
 }
@@ -9,6 +9,20 @@ void gcd(mpz_t g, mpz_t a, mpz_t b);
 
 void mod_inverse(mpz_t o, mpz_t a, mpz_t n);
 
+//An exponent recoded once into sliding-window digits, most significant first. Each digit stands
+//for one squaring followed, if the digit is non-zero, by a multiply with a^digit.
+typedef struct PowExp {
+    uint8_t *digits;
+    uint64_t len;
+    uint64_t width;
+} PowExp;
+
+void pow_exp_init(PowExp *x, mpz_t d);
+
+void pow_exp_clear(PowExp *x);
+
+void pow_mod_exp(mpz_t o, mpz_t a, PowExp *x, mpz_t n);
+
 void pow_mod(mpz_t o, mpz_t a, mpz_t d, mpz_t n);
 
 bool is_prime(mpz_t n, uint64_t iters);
@@ -1,6 +1,10 @@
 #include "numtheory.h"
 #include "randstate.h"
 #include "rsa.h"
+#include "aio.h"
+#include "lz.h"
+#include "sha256.h"
+#include "stats.h"
 
 #include <stdlib.h>
 #include <inttypes.h>
@@ -12,9 +16,16 @@
 
 gmp_randstate_t state;
 
+//First byte of every plaintext block. It keeps the block from starting with zeros and marks compressed data.
+#define RSA_PREFIX_RAW 0xFF
+#define RSA_PREFIX_LZ  0xFE
+
 //This function creates parts of a new RSA Public key, which include two large primes and their product n and their public exponent e.
 void rsa_make_pub(mpz_t p, mpz_t q, mpz_t n, mpz_t e, uint64_t nbits, uint64_t iters) {
 
+    StatTimer timer;
+    stats_start(&timer);
+
     uint64_t pbits = rand() % (2 * nbits) / 4;
 
     pbits += nbits / 4;
@@ -45,6 +56,7 @@ void rsa_make_pub(mpz_t p, mpz_t q, mpz_t n, mpz_t e, uint64_t nbits, uint64_t i
     mpz_mul(n, p, q);
 
     mpz_clears(p_minus_one, q_minus_one, totient, e_gcd, NULL);
+    stats_stop(&timer, PHASE_KEYGEN);
     return;
 }
 
@@ -58,16 +70,22 @@ void rsa_write_pub(mpz_t n, mpz_t e, mpz_t s, char username[], FILE *pbfile) {
 }
 
 void rsa_read_pub(mpz_t n, mpz_t e, mpz_t s, char username[], FILE *pbfile) {
+    StatTimer timer;
+    stats_start(&timer);
     gmp_fscanf(pbfile,
         "%Zx\n"
         "%Zx\n"
         "%Zx\n"
         "%s\n",
         n, e, s, username);
+    stats_stop(&timer, PHASE_KEY_PARSE);
 }
 
 void rsa_make_priv(mpz_t d, mpz_t e, mpz_t p, mpz_t q) {
 
+    StatTimer timer;
+    stats_start(&timer);
+
     mpz_t p_minus_one, q_minus_one, totient;
     mpz_inits(p_minus_one, q_minus_one, totient, NULL);
 
@@ -80,6 +98,7 @@ void rsa_make_priv(mpz_t d, mpz_t e, mpz_t p, mpz_t q) {
     mod_inverse(d, e, totient);
 
     mpz_clears(p_minus_one, q_minus_one, totient, NULL);
+    stats_stop(&timer, PHASE_KEYGEN);
 }
 
 void rsa_write_priv(mpz_t n, mpz_t d, FILE *pvfile) {
@@ -90,21 +109,60 @@ void rsa_write_priv(mpz_t n, mpz_t d, FILE *pvfile) {
 }
 
 void rsa_read_priv(mpz_t n, mpz_t d, FILE *pvfile) {
+    StatTimer timer;
+    stats_start(&timer);
     gmp_fscanf(pvfile,
         "%Zx\n"
         "%Zx\n",
         n, d);
+    stats_stop(&timer, PHASE_KEY_PARSE);
 }
 
 void rsa_encrypt(mpz_t c, mpz_t m, mpz_t e, mpz_t n) {
     pow_mod(c, m, e, n);
 }
 
-void rsa_encrypt_file(FILE *infile, FILE *outfile, mpz_t n, mpz_t e) {
+//Encrypts the first len bytes of block (the prefix byte plus data) and writes it to out as a hexstring.
+//hex must hold mpz_sizeinbase(n, 16) + 2 characters. x is the public exponent, recoded once per file.
+static void rsa_encrypt_block(
+    AIOWriter *out, uint8_t *block, uint64_t len, char *hex, mpz_t m, mpz_t c, PowExp *x, mpz_t n) {
+
+    //Converting the bytes including the prefix into an mpz_t.
+    mpz_import(m, len, 1, sizeof(uint8_t), 1, 0, block);
+
+    //Creating the encrypted number
+    pow_mod_exp(c, m, x, n);
+
+    //Printing out the number to an outfile as a hexstring.
+    mpz_get_str(hex, 16, c);
+    uint64_t hex_len = strlen(hex);
+    hex[hex_len++] = '\n';
+    aio_write(out, (uint8_t *) hex, hex_len);
+
+    stats_add(STAT_BLOCKS, 1);
+}
+
+//Encrypts at most length bytes from the current position of infile. Reading, encrypting and
+//writing run on separate threads connected by rings of buffers, so disk waits overlap modexp.
+//Returns false if reading infile or writing outfile failed.
+static bool rsa_encrypt_range(
+    FILE *infile, FILE *outfile, mpz_t n, mpz_t e, bool compress, uint64_t length) {
+
+    StatTimer timer;
+    stats_start(&timer);
 
     mpz_t m, c;
     mpz_inits(m, c, NULL);
     uint64_t bytes_read;
+    AIOReader in;
+    AIOWriter out;
+    aio_reader_init(&in, infile, length);
+    aio_writer_init(&out, outfile);
+    char *hex = (char *) malloc(mpz_sizeinbase(n, 16) + 2);
+
+    //Recoding e once instead of rescanning it for every block
+    PowExp x;
+    pow_exp_init(&x, e);
 
     //Calculating block size k
     uint64_t k = (mpz_sizeinbase(n, 2) - 1) / 8;
@@ -112,38 +170,135 @@ void rsa_encrypt_file(FILE *infile, FILE *outfile, mpz_t n, mpz_t e) {
     //Dynamically allocating the block using k as the size
     uint8_t *block = (uint8_t *) calloc(k, sizeof(uint8_t *));
 
-    //Prepending 0xFF to the zeroth byte of the block to place the work around.
-    block[0] = 0xFF;
+    //Prepending the prefix to the zeroth byte of the block to place the work around. It also tells decrypt whether the data is compressed.
+    block[0] = compress ? RSA_PREFIX_LZ : RSA_PREFIX_RAW;
+
+    if (!compress) {
+        //Reading k-1 bytes from infile and encrypting them until a short read at the EOF or the end of the range.
+        do {
+            bytes_read = aio_read(&in, block + 1, k - 1);
+            rsa_encrypt_block(&out, block, bytes_read + 1, hex, m, c, &x, n);
+        } while (bytes_read == k - 1);
+    } else {
+        //Compressing the input a frame at a time and packing the frames into blocks back to back.
+        uint8_t *raw = (uint8_t *) malloc(LZ_FRAME_SIZE);
+        uint8_t *frame = (uint8_t *) malloc(LZ_HEADER_SIZE + LZ_BOUND(LZ_FRAME_SIZE));
+        uint64_t filled = 0;
+
+        while ((bytes_read = aio_read(&in, raw, LZ_FRAME_SIZE)) > 0) {
+            uint64_t frame_len = lz_frame(raw, bytes_read, frame);
+            uint64_t pos = 0;
+            while (pos < frame_len) {
+                uint64_t take = k - 1 - filled;
+                if (take > frame_len - pos) {
+                    take = frame_len - pos;
+                }
+                memcpy(block + 1 + filled, frame + pos, take);
+                filled += take;
+                pos += take;
+                if (filled == k - 1) {
+                    rsa_encrypt_block(&out, block, k, hex, m, c, &x, n);
+                    filled = 0;
+                }
+            }
+        }
+
+        //The last block holds whatever is left over, possibly nothing.
+        rsa_encrypt_block(&out, block, filled + 1, hex, m, c, &x, n);
+
+        free(raw);
+        free(frame);
+    }
+    //Clearing the mpz variables.
+    mpz_clears(m, c, NULL);
+    bool read_ok = aio_reader_clear(&in);
+    bool write_ok = aio_writer_clear(&out);
+    pow_exp_clear(&x);
+    free(hex);
+    free(block);
+    stats_stop(&timer, PHASE_ENCRYPT);
+    return read_ok && write_ok;
+}
 
-    //Reading k-1 bytes from infile and adding the amount of bytes read to bytes_read until the EOF is reached.
-    while (feof(infile) == 0) {
+bool rsa_encrypt_file(FILE *infile, FILE *outfile, mpz_t n, mpz_t e, bool compress) {
+    return rsa_encrypt_range(infile, outfile, n, e, compress, UINT64_MAX);
+}
 
-        bytes_read = fread(block + 1, sizeof(uint8_t), k - 1, infile);
+//Encrypts length bytes of infile starting at offset into a segment that can be decrypted on its own.
+//The segment starts with a header line recording where its plaintext belongs.
+bool rsa_encrypt_shard(FILE *infile, FILE *outfile, mpz_t n, mpz_t e, bool compress,
+    uint64_t index, uint64_t count, uint64_t offset, uint64_t length) {
+    fprintf(outfile, "shard %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 "\n", index, count,
+        offset, length);
+    if (fseeko(infile, offset, SEEK_SET) != 0) {
+        return false;
+    }
+    return rsa_encrypt_range(infile, outfile, n, e, compress, length);
+}
 
-        //Converting the read bytes including hte 0xFF into an mpz_t.
-        mpz_import(m, bytes_read + 1, 1, sizeof(uint8_t), 1, 0, block);
+//Returns true if the next character in infile is tag. Ciphertext is hex, so a letter past f marks a header.
+static bool rsa_starts_with(FILE *infile, int tag) {
+    int ch = getc(infile);
+    if (ch != EOF) {
+        ungetc(ch, infile);
+    }
+    return ch == tag;
+}
 
-        //Creating the encrypted number
-        rsa_encrypt(c, m, e, n);
+//Returns true if infile starts with a segment header, without consuming anything.
+bool rsa_is_shard(FILE *infile) {
+    return rsa_starts_with(infile, 's');
+}
 
-        //Printing out the number to an outfile as a hexstring.
-        gmp_fprintf(outfile, "%Zx\n", c);
-    }
-    //Clearing the mpz variables.
-    mpz_clears(m, c, NULL);
-    free(block);
+//Reads a segment header. Returns false if it is malformed.
+bool rsa_read_shard(
+    FILE *infile, uint64_t *index, uint64_t *count, uint64_t *offset, uint64_t *length) {
+    return fscanf(infile, "shard %" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64 "\n", index, count,
+               offset, length)
+           == 4;
+}
+
+//Writes the header line of a manifest. The segment names follow it, one per line.
+void rsa_write_manifest(FILE *outfile, uint64_t count, uint64_t length) {
+    fprintf(outfile, "manifest %" PRIu64 " %" PRIu64 "\n", count, length);
+}
+
+//Returns true if infile starts with a manifest header, without consuming anything.
+bool rsa_is_manifest(FILE *infile) {
+    return rsa_starts_with(infile, 'm');
+}
+
+//Reads a manifest header. Returns false if it is malformed.
+bool rsa_read_manifest(FILE *infile, uint64_t *count, uint64_t *length) {
+    return fscanf(infile, "manifest %" SCNu64 " %" SCNu64 "\n", count, length) == 2;
 }
 
 void rsa_decrypt(mpz_t m, mpz_t c, mpz_t d, mpz_t n) {
     pow_mod(m, c, d, n);
 }
 
-void rsa_decrypt_file(FILE *infile, FILE *outfile, mpz_t n, mpz_t d) {
+//Decrypts infile into outfile and stores the number of plaintext bytes into written, if it is not NULL.
+//Returns false if infile is corrupt, including a segment whose plaintext length does not match its header,
+//or if reading infile or writing outfile failed.
+bool rsa_decrypt_file(FILE *infile, FILE *outfile, mpz_t n, mpz_t d, uint64_t *written) {
+
+    StatTimer timer;
+    stats_start(&timer);
 
     //Creating variables for function
     mpz_t m, c;
     mpz_inits(m, c, NULL);
     uint64_t bytes_read;
+    bool ok = true;
+    LZStream stream;
+    lz_stream_init(&stream);
+
+    //A single segment decrypts like a whole file once its header is read
+    uint64_t index, count, offset, length;
+    bool shard = rsa_is_shard(infile);
+    if (shard && !rsa_read_shard(infile, &index, &count, &offset, &length)) {
+        ok = false;
+    }
 
     //Calculating block size k
     uint64_t k = (mpz_sizeinbase(n, 2) - 1) / 8;
@@ -151,23 +306,82 @@ void rsa_decrypt_file(FILE *infile, FILE *outfile, mpz_t n, mpz_t d) {
     //Dynamically allocating the block using k as the size
     uint8_t *block = (uint8_t *) calloc(k, sizeof(uint8_t *));
 
-    //Insert comment
-    while (feof(infile) == 0) {
-        //Scan in the number from an infile as a hexstring.
-        gmp_fscanf(infile, "%Zx\n", c);
+    //Reading and writing happen on their own threads while this one decrypts
+    AIOReader in;
+    AIOWriter out;
+    aio_reader_init(&in, infile, UINT64_MAX);
+    aio_writer_init(&out, outfile);
+    uint64_t hex_cap = mpz_sizeinbase(n, 16) + 2;
+    char *hex = (char *) malloc(hex_cap);
+
+    //Recoding d once instead of rescanning it for every block
+    PowExp x;
+    pow_exp_init(&x, d);
+
+    //Decrypting one hexstring line at a time until the EOF is reached.
+    bool fits;
+    while (ok && aio_read_line(&in, hex, hex_cap, &fits)) {
+        //A line longer than any ciphertext below n cannot have come from encrypt
+        if (!fits) {
+            ok = false;
+            break;
+        }
+
+        //Skipping blank lines
+        if (hex[0] == '\0') {
+            continue;
+        }
+
+        //Scan in the number as a hexstring.
+        if (mpz_set_str(c, hex, 16) != 0) {
+            ok = false;
+            break;
+        }
+        stats_add(STAT_BLOCKS, 1);
 
         //Decrypting c and storing back into m
-        rsa_decrypt(m, c, d, n);
+        pow_mod_exp(m, c, &x, n);
 
         //Insert Comment
         mpz_export(block, &bytes_read, 1, sizeof(uint8_t), 1, 0, m);
 
-        //Writing the the decrypted data to an outfile
-        fwrite(block + 1, sizeof(uint8_t), bytes_read - 1, outfile);
+        //Every block encrypt writes is k bytes at most and starts with one of the two prefixes
+        if (bytes_read == 0 || bytes_read > k
+            || (block[0] != RSA_PREFIX_RAW && block[0] != RSA_PREFIX_LZ)) {
+            ok = false;
+            break;
+        }
+
+        //The prefix byte tells whether the block holds compressed frames or plain data
+        if (block[0] == RSA_PREFIX_LZ) {
+            if (!lz_stream_feed(&stream, block + 1, bytes_read - 1, &out)) {
+                ok = false;
+                break;
+            }
+        } else {
+            //Writing the the decrypted data to an outfile
+            aio_write(&out, block + 1, bytes_read - 1);
+        }
+    }
+    //A compressed stream has to end on a frame boundary.
+    ok = ok && lz_stream_done(&stream);
+
+    //A segment has to hold exactly as many bytes as its header says.
+    ok = ok && (!shard || out.total == length);
+    if (written != NULL) {
+        *written = out.total;
     }
+
     //Clearing the mpz variables.
     mpz_clears(m, c, NULL);
+    lz_stream_clear(&stream);
+    ok = aio_reader_clear(&in) && ok;
+    ok = aio_writer_clear(&out) && ok;
+    pow_exp_clear(&x);
+    free(hex);
     free(block);
+    stats_stop(&timer, PHASE_DECRYPT);
+    return ok;
 }
 
 void rsa_sign(mpz_t s, mpz_t m, mpz_t d, mpz_t n) {
@@ -185,3 +399,73 @@ bool rsa_verify(mpz_t m, mpz_t s, mpz_t e, mpz_t n) {
     mpz_clear(v);
     return false;
 }
+
+//Converts the SHA-256 digest of the rest of infile into an mpz_t that is less than n.
+//Returns false if infile could not be read to the end.
+static bool rsa_digest_file(mpz_t m, FILE *infile, mpz_t n) {
+    uint8_t digest[SHA256_DIGEST_BYTES];
+    StatTimer timer;
+    stats_start(&timer);
+    bool ok = sha256_file(infile, digest);
+    stats_stop(&timer, PHASE_HASH);
+    mpz_import(m, SHA256_DIGEST_BYTES, 1, sizeof(uint8_t), 1, 0, digest);
+    mpz_mod(m, m, n);
+    return ok;
+}
+
+//Converts the SHA-256 digests of count files, hashed side by side, into mpz_ts that are less than n.
+//A single file leaves the other vector lanes idle, so it goes through the scalar hash instead.
+//Returns false if any file could not be read to the end.
+static bool rsa_digest_files(mpz_t *m, FILE *infiles[], uint64_t count, mpz_t n) {
+    if (count == 1) {
+        return rsa_digest_file(m[0], infiles[0], n);
+    }
+    uint8_t(*digests)[SHA256_DIGEST_BYTES] = malloc(count * SHA256_DIGEST_BYTES);
+    if (digests == NULL) {
+        return false;
+    }
+    StatTimer timer;
+    stats_start(&timer);
+    bool ok = sha256_files(infiles, count, digests);
+    stats_stop(&timer, PHASE_HASH);
+    for (uint64_t i = 0; ok && i < count; i++) {
+        mpz_import(m[i], SHA256_DIGEST_BYTES, 1, sizeof(uint8_t), 1, 0, digests[i]);
+        mpz_mod(m[i], m[i], n);
+    }
+    free(digests);
+    return ok;
+}
+
+//Signs count files into s[0..count-1], hashing them in parallel first.
+//Returns false without signing if any file could not be read to the end.
+bool rsa_sign_files(mpz_t *s, FILE *infiles[], uint64_t count, mpz_t d, mpz_t n) {
+    mpz_t *m = (mpz_t *) malloc(count * sizeof(mpz_t));
+    for (uint64_t i = 0; i < count; i++) {
+        mpz_init(m[i]);
+    }
+    bool ok = rsa_digest_files(m, infiles, count, n);
+    for (uint64_t i = 0; i < count; i++) {
+        if (ok) {
+            rsa_sign(s[i], m[i], d, n);
+        }
+        mpz_clear(m[i]);
+    }
+    free(m);
+    return ok;
+}
+
+//Checks s[i] against the digest of infiles[i] for every file, hashing them in parallel first.
+//Returns false if any file could not be read to the end.
+bool rsa_verify_files(FILE *infiles[], mpz_t *s, uint64_t count, mpz_t e, mpz_t n, bool verified[]) {
+    mpz_t *m = (mpz_t *) malloc(count * sizeof(mpz_t));
+    for (uint64_t i = 0; i < count; i++) {
+        mpz_init(m[i]);
+    }
+    bool ok = rsa_digest_files(m, infiles, count, n);
+    for (uint64_t i = 0; i < count; i++) {
+        verified[i] = ok && rsa_verify(m[i], s[i], e, n);
+        mpz_clear(m[i]);
+    }
+    free(m);
+    return ok;
+}
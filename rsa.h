@@ -19,12 +19,30 @@ void rsa_read_priv(mpz_t n, mpz_t d, FILE *pvfile);
 
 void rsa_encrypt(mpz_t c, mpz_t m, mpz_t e, mpz_t n);
 
-void rsa_encrypt_file(FILE *infile, FILE *outfile, mpz_t n, mpz_t e);
+bool rsa_encrypt_file(FILE *infile, FILE *outfile, mpz_t n, mpz_t e, bool compress);
+
+bool rsa_encrypt_shard(FILE *infile, FILE *outfile, mpz_t n, mpz_t e, bool compress,
+    uint64_t index, uint64_t count, uint64_t offset, uint64_t length);
+
+bool rsa_is_shard(FILE *infile);
+
+bool rsa_read_shard(
+    FILE *infile, uint64_t *index, uint64_t *count, uint64_t *offset, uint64_t *length);
+
+void rsa_write_manifest(FILE *outfile, uint64_t count, uint64_t length);
+
+bool rsa_is_manifest(FILE *infile);
+
+bool rsa_read_manifest(FILE *infile, uint64_t *count, uint64_t *length);
 
 void rsa_decrypt(mpz_t m, mpz_t c, mpz_t d, mpz_t n);
 
-void rsa_decrypt_file(FILE *infile, FILE *outfile, mpz_t n, mpz_t d);
+bool rsa_decrypt_file(FILE *infile, FILE *outfile, mpz_t n, mpz_t d, uint64_t *written);
 
 void rsa_sign(mpz_t s, mpz_t m, mpz_t d, mpz_t n);
 
 bool rsa_verify(mpz_t m, mpz_t s, mpz_t e, mpz_t n);
+
+bool rsa_sign_files(mpz_t *s, FILE *infiles[], uint64_t count, mpz_t d, mpz_t n);
+
+bool rsa_verify_files(FILE *infiles[], mpz_t *s, uint64_t count, mpz_t e, mpz_t n, bool verified[]);
@@ -0,0 +1,354 @@
+#include "sha256.h"
+#include "stats.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+//Size of the buffer used when hashing a whole file (1 MiB).
+#define SHA256_FILE_CHUNK (1 << 20)
+
+//The round constants from FIPS 180-4.
+static const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+//One 32-bit word from each lane. Arithmetic on it compiles to SIMD instructions.
+typedef uint32_t sha256_lanes __attribute__((vector_size(SHA256_LANES * sizeof(uint32_t))));
+
+static inline uint32_t rotr(uint32_t x, uint32_t n) {
+    return (x >> n) | (x << (32 - n));
+}
+
+//A macro rather than a function, since passing wide vectors by value depends on the target's ABI.
+#define ROTR_LANES(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+//Runs the compression function over one or more consecutive 64 byte blocks.
+static void sha256_blocks(uint32_t h[8], const uint8_t *data, uint64_t nblocks) {
+    uint32_t w[64];
+
+    while (nblocks-- > 0) {
+        //Loading the message schedule as big-endian words
+        for (int i = 0; i < 16; i++) {
+            w[i] = ((uint32_t) data[4 * i] << 24) | ((uint32_t) data[4 * i + 1] << 16)
+                   | ((uint32_t) data[4 * i + 2] << 8) | (uint32_t) data[4 * i + 3];
+        }
+        for (int i = 16; i < 64; i++) {
+            uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3];
+        uint32_t e = h[4], f = h[5], g = h[6], k = h[7];
+
+        for (int i = 0; i < 64; i++) {
+            uint32_t t1 = k + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + K[i]
+                          + w[i];
+            uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            k = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+
+        h[0] += a;
+        h[1] += b;
+        h[2] += c;
+        h[3] += d;
+        h[4] += e;
+        h[5] += f;
+        h[6] += g;
+        h[7] += k;
+
+        data += 64;
+    }
+}
+
+//Runs the compression function over nblocks consecutive blocks in every lane at once.
+//Lane l reads its blocks from data[l] and updates h[l].
+static void sha256_blocks_lanes(
+    uint32_t *h[SHA256_LANES], const uint8_t *data[SHA256_LANES], uint64_t nblocks) {
+    sha256_lanes w[64], state[8];
+
+    //Transposing the lanes' states so each vector holds the same word of every lane
+    for (int j = 0; j < 8; j++) {
+        for (int l = 0; l < SHA256_LANES; l++) {
+            state[j][l] = h[l][j];
+        }
+    }
+
+    for (uint64_t blk = 0; blk < nblocks; blk++) {
+        for (int i = 0; i < 16; i++) {
+            for (int l = 0; l < SHA256_LANES; l++) {
+                const uint8_t *p = data[l] + 64 * blk + 4 * i;
+                w[i][l] = ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8)
+                          | (uint32_t) p[3];
+            }
+        }
+        for (int i = 16; i < 64; i++) {
+            sha256_lanes s0
+                = ROTR_LANES(w[i - 15], 7) ^ ROTR_LANES(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            sha256_lanes s1
+                = ROTR_LANES(w[i - 2], 17) ^ ROTR_LANES(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        sha256_lanes a = state[0], b = state[1], c = state[2], d = state[3];
+        sha256_lanes e = state[4], f = state[5], g = state[6], k = state[7];
+
+        for (int i = 0; i < 64; i++) {
+            sha256_lanes t1 = k + (ROTR_LANES(e, 6) ^ ROTR_LANES(e, 11) ^ ROTR_LANES(e, 25))
+                              + ((e & f) ^ (~e & g)) + K[i] + w[i];
+            sha256_lanes t2 = (ROTR_LANES(a, 2) ^ ROTR_LANES(a, 13) ^ ROTR_LANES(a, 22))
+                              + ((a & b) ^ (a & c) ^ (b & c));
+            k = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += k;
+    }
+
+    for (int j = 0; j < 8; j++) {
+        for (int l = 0; l < SHA256_LANES; l++) {
+            h[l][j] = state[j][l];
+        }
+    }
+}
+
+void sha256_init(SHA256 *ctx) {
+    ctx->h[0] = 0x6a09e667;
+    ctx->h[1] = 0xbb67ae85;
+    ctx->h[2] = 0x3c6ef372;
+    ctx->h[3] = 0xa54ff53a;
+    ctx->h[4] = 0x510e527f;
+    ctx->h[5] = 0x9b05688c;
+    ctx->h[6] = 0x1f83d9ab;
+    ctx->h[7] = 0x5be0cd19;
+    ctx->buf_len = 0;
+    ctx->total = 0;
+}
+
+void sha256_update(SHA256 *ctx, const uint8_t *data, uint64_t len) {
+    ctx->total += len;
+
+    //Topping up a partially filled block first
+    if (ctx->buf_len > 0) {
+        uint64_t take = 64 - ctx->buf_len;
+        if (take > len) {
+            take = len;
+        }
+        memcpy(ctx->buf + ctx->buf_len, data, take);
+        ctx->buf_len += take;
+        data += take;
+        len -= take;
+        if (ctx->buf_len < 64) {
+            return;
+        }
+        sha256_blocks(ctx->h, ctx->buf, 1);
+        ctx->buf_len = 0;
+    }
+
+    //Hashing every whole block straight out of the caller's buffer
+    sha256_blocks(ctx->h, data, len / 64);
+
+    //Saving the leftover bytes for the next call
+    ctx->buf_len = len % 64;
+    memcpy(ctx->buf, data + len - ctx->buf_len, ctx->buf_len);
+}
+
+void sha256_final(SHA256 *ctx, uint8_t digest[SHA256_DIGEST_BYTES]) {
+    uint64_t bits = ctx->total * 8;
+
+    //Padding with 0x80, zeros and the 64-bit message length
+    ctx->buf[ctx->buf_len++] = 0x80;
+    if (ctx->buf_len > 56) {
+        memset(ctx->buf + ctx->buf_len, 0, 64 - ctx->buf_len);
+        sha256_blocks(ctx->h, ctx->buf, 1);
+        ctx->buf_len = 0;
+    }
+    memset(ctx->buf + ctx->buf_len, 0, 56 - ctx->buf_len);
+    for (int i = 0; i < 8; i++) {
+        ctx->buf[56 + i] = (uint8_t) (bits >> (56 - 8 * i));
+    }
+    sha256_blocks(ctx->h, ctx->buf, 1);
+
+    for (int i = 0; i < 8; i++) {
+        digest[4 * i] = (uint8_t) (ctx->h[i] >> 24);
+        digest[4 * i + 1] = (uint8_t) (ctx->h[i] >> 16);
+        digest[4 * i + 2] = (uint8_t) (ctx->h[i] >> 8);
+        digest[4 * i + 3] = (uint8_t) ctx->h[i];
+    }
+}
+
+//Hashes everything left in infile in large chunks. Returns false if infile could not be read to
+//the end, so a read error is never mistaken for the EOF.
+bool sha256_file(FILE *infile, uint8_t digest[SHA256_DIGEST_BYTES]) {
+    SHA256 ctx;
+    StatTimer timer;
+    uint64_t bytes_read;
+    uint8_t *chunk = (uint8_t *) malloc(SHA256_FILE_CHUNK);
+    if (chunk == NULL) {
+        return false;
+    }
+
+    sha256_init(&ctx);
+    do {
+        stats_start(&timer);
+        bytes_read = fread(chunk, sizeof(uint8_t), SHA256_FILE_CHUNK, infile);
+        stats_stop(&timer, PHASE_IO);
+        stats_add(STAT_BYTES_IN, bytes_read);
+        sha256_update(&ctx, chunk, bytes_read);
+    } while (bytes_read > 0);
+    sha256_final(&ctx, digest);
+
+    free(chunk);
+    return ferror(infile) == 0;
+}
+
+//Per-file state for sha256_files. buf holds bytes read from file that are not hashed yet.
+typedef struct SHA256Lane {
+    SHA256 ctx;
+    FILE *file;
+    uint8_t *buf;
+    uint64_t pos;
+    uint64_t len;
+    bool eof;
+} SHA256Lane;
+
+//Tops up a lane's buffer once it holds less than a block. Returns true if it then holds a block.
+static bool sha256_lane_fill(SHA256Lane *lane) {
+    if (!lane->eof && lane->len - lane->pos < 64) {
+        StatTimer timer;
+
+        memmove(lane->buf, lane->buf + lane->pos, lane->len - lane->pos);
+        lane->len -= lane->pos;
+        lane->pos = 0;
+
+        stats_start(&timer);
+        uint64_t bytes_read = fread(
+            lane->buf + lane->len, sizeof(uint8_t), SHA256_FILE_CHUNK - lane->len, lane->file);
+        stats_stop(&timer, PHASE_IO);
+        stats_add(STAT_BYTES_IN, bytes_read);
+
+        lane->len += bytes_read;
+        lane->eof = bytes_read == 0;
+    }
+    return lane->len - lane->pos >= 64;
+}
+
+//Hashes up to SHA256_LANES files side by side. Returns false if any of them could not be read to the end.
+static bool sha256_files_lanes(SHA256Lane *lanes, uint64_t count) {
+    uint32_t scratch[8];
+    uint32_t *h[SHA256_LANES];
+    const uint8_t *data[SHA256_LANES];
+
+    while (true) {
+        //Finding the lanes holding at least one block and how many blocks all of them hold
+        uint64_t ready = 0, nblocks = UINT64_MAX;
+        int64_t last = -1;
+        for (uint64_t l = 0; l < count; l++) {
+            if (sha256_lane_fill(&lanes[l])) {
+                uint64_t blocks = (lanes[l].len - lanes[l].pos) / 64;
+                nblocks = blocks < nblocks ? blocks : nblocks;
+                ready++;
+                last = l;
+            }
+        }
+        if (ready == 0) {
+            break;
+        }
+
+        //A single busy lane is cheaper to hash on its own
+        if (ready == 1) {
+            sha256_blocks(lanes[last].ctx.h, lanes[last].buf + lanes[last].pos, nblocks);
+        } else {
+            //Idle lanes hash a busy lane's data into scratch so every lane always has valid input
+            for (uint64_t l = 0; l < SHA256_LANES; l++) {
+                bool busy = l < count && lanes[l].len - lanes[l].pos >= 64;
+                h[l] = busy ? lanes[l].ctx.h : scratch;
+                data[l] = busy ? lanes[l].buf + lanes[l].pos : lanes[last].buf + lanes[last].pos;
+            }
+            sha256_blocks_lanes(h, data, nblocks);
+        }
+
+        for (uint64_t l = 0; l < count; l++) {
+            if (lanes[l].len - lanes[l].pos >= 64) {
+                lanes[l].pos += 64 * nblocks;
+                lanes[l].ctx.total += 64 * nblocks;
+            }
+        }
+    }
+
+    //Every lane is at its EOF with less than a block left
+    bool ok = true;
+    for (uint64_t l = 0; l < count; l++) {
+        sha256_update(&lanes[l].ctx, lanes[l].buf + lanes[l].pos, lanes[l].len - lanes[l].pos);
+        ok = ok && ferror(lanes[l].file) == 0;
+    }
+    return ok;
+}
+
+//Hashes every file in infiles, SHA256_LANES at a time in parallel vector lanes, and stores the
+//digests in the same order. Returns false if any file could not be read to the end.
+bool sha256_files(FILE *infiles[], uint64_t count, uint8_t digests[][SHA256_DIGEST_BYTES]) {
+    SHA256Lane lanes[SHA256_LANES];
+    bool ok = true;
+
+    for (uint64_t i = 0; i < count; i += SHA256_LANES) {
+        uint64_t group = count - i < SHA256_LANES ? count - i : SHA256_LANES;
+
+        bool allocated = true;
+        for (uint64_t l = 0; l < group; l++) {
+            sha256_init(&lanes[l].ctx);
+            lanes[l].file = infiles[i + l];
+            lanes[l].buf = (uint8_t *) malloc(SHA256_FILE_CHUNK);
+            lanes[l].pos = 0;
+            lanes[l].len = 0;
+            lanes[l].eof = false;
+            allocated = allocated && lanes[l].buf != NULL;
+        }
+
+        if (allocated && sha256_files_lanes(lanes, group)) {
+            for (uint64_t l = 0; l < group; l++) {
+                sha256_final(&lanes[l].ctx, digests[i + l]);
+            }
+        } else {
+            ok = false;
+        }
+
+        for (uint64_t l = 0; l < group; l++) {
+            free(lanes[l].buf);
+        }
+        if (!ok) {
+            break;
+        }
+    }
+    return ok;
+}
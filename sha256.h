@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define SHA256_DIGEST_BYTES 32
+
+//Number of files sha256_files hashes side by side in vector lanes.
+#define SHA256_LANES 8
+
+typedef struct SHA256 {
+    uint32_t h[8];
+    uint8_t buf[64];
+    uint64_t buf_len;
+    uint64_t total;
+} SHA256;
+
+void sha256_init(SHA256 *ctx);
+
+void sha256_update(SHA256 *ctx, const uint8_t *data, uint64_t len);
+
+void sha256_final(SHA256 *ctx, uint8_t digest[SHA256_DIGEST_BYTES]);
+
+bool sha256_file(FILE *infile, uint8_t digest[SHA256_DIGEST_BYTES]);
+
+bool sha256_files(FILE *infiles[], uint64_t count, uint8_t digests[][SHA256_DIGEST_BYTES]);
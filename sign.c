@@ -0,0 +1,161 @@
+#include "rsa.h"
+#include "numtheory.h"
+#include "randstate.h"
+#include "stats.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <string.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <gmp.h>
+
+/****************************************************/
+// Filename: sign.c
+// Created: Dylan Do
+/****************************************************/
+
+void help(); //Declaration for the help function.
+
+static struct option long_options[] = { STATS_LONG_OPTION, { 0, 0, 0, 0 } };
+
+int main(int argc, char **argv) {
+
+    //Creating variables needed for sign
+    int opt = 0;
+    mpz_t n, d;
+    mpz_inits(n, d, NULL);
+    bool verbose = false;
+    bool stats = false;
+    bool stats_json = false;
+    //The infiles are the files being signed, one per -i. Set to stdin by default.
+    FILE **infiles = (FILE **) calloc(argc + 1, sizeof(FILE *));
+    char **names = (char **) calloc(argc + 1, sizeof(char *));
+    uint64_t count = 0;
+    char *sig = "rsa.sig";
+    char *priv = "rsa.priv";
+
+    //This while loop is responsible for parsing through the command-lines given by a user.
+    while ((opt = getopt_long(argc, argv, "i:o:n:vh", long_options, NULL)) != -1) {
+
+        //This if statement is responsible for printing out the help statement if the user inputs an unknown command-line.
+        if (opt == '?') {
+            help();
+            return -1;
+        }
+
+        //This are all the cases.
+        switch (opt) {
+        case 'v': verbose = true; break;
+        case 'S':
+            stats = true;
+            if (!stats_parse_arg(optarg, &stats_json)) {
+                help();
+                return -1;
+            }
+            break;
+        case 'h':
+            help();
+            return -1;
+        case 'i':
+            names[count] = optarg;
+            infiles[count++] = fopen(optarg, "r");
+            break;
+        case 'o': sig = optarg; break;
+        case 'n': priv = optarg;
+        }
+    }
+
+    if (count == 0) {
+        names[count] = "stdin";
+        infiles[count++] = stdin;
+    }
+    for (uint64_t i = 0; i < count; i++) {
+        if (infiles[i] == NULL) {
+            printf("Error, failed to open input file %s.\n", names[i]);
+            return 1;
+        }
+    }
+
+    FILE *pvfile = fopen(priv, "r");
+    if (pvfile == NULL) {
+        printf("Error, failed to open private key file.");
+        return 1;
+    }
+
+    rsa_read_priv(n, d, pvfile);
+
+    if (verbose) {
+        gmp_printf("n (%zu bits) = %Zd\n", mpz_sizeinbase(n, 2), n);
+        gmp_printf("d (%zu bits) = %Zd\n", mpz_sizeinbase(d, 2), d);
+    }
+
+    //Hashing the whole files side by side and signing each digest
+    mpz_t *s = (mpz_t *) malloc(count * sizeof(mpz_t));
+    for (uint64_t i = 0; i < count; i++) {
+        mpz_init(s[i]);
+    }
+    if (!rsa_sign_files(s, infiles, count, d, n)) {
+        printf("Error, failed to read input file.\n");
+        return 1;
+    }
+
+    //The signature file holds one signature per input, in the order they were given
+    FILE *sigfile = fopen(sig, "w");
+    if (sigfile == NULL) {
+        printf("Error, failed to open signature file.");
+        return 1;
+    }
+    bool ok = true;
+    for (uint64_t i = 0; i < count; i++) {
+        ok = gmp_fprintf(sigfile, "%Zx\n", s[i]) > 0 && ok;
+        if (verbose) {
+            gmp_printf("s %s (%zu bits) = %Zd\n", names[i], mpz_sizeinbase(s[i], 2), s[i]);
+        }
+    }
+
+    //Prints out the instrumentation if indicated by user.
+    if (stats) {
+        stats_print(stderr, stats_json);
+    }
+
+    mpz_clears(n, d, NULL);
+    for (uint64_t i = 0; i < count; i++) {
+        mpz_clear(s[i]);
+        fclose(infiles[i]);
+    }
+    free(s);
+    free(infiles);
+    free(names);
+    ok = fclose(sigfile) == 0 && ok;
+    fclose(pvfile);
+    if (!ok) {
+        printf("Error, failed to write signature file.\n");
+        return 1;
+    }
+}
+
+//Helper function that prints out the help statement.
+void help() {
+    printf("SYNOPSIS\n");
+    printf("   Signs files using RSA over their SHA-256 digests.\n");
+    printf("   Signatures are checked by the verify program.\n");
+    printf("\n");
+    printf("USAGE\n");
+    printf("   ./sign [-hv] [-i infile]... [-o sigfile] [-n privkey]\n");
+    printf("\n");
+    printf("OPTIONS\n");
+    printf("   -h              Display program help and usage.\n");
+    printf("   -v              Display verbose program output.\n");
+    printf("   --stats[=json]  Print operation counters and phase timings to stderr.\n");
+    printf("   -i infile       Input file to sign, may be repeated (default: stdin).\n");
+    printf("                   Several inputs are hashed in parallel.\n");
+    printf("   -o sigfile      Output file for the signatures, one line per input (default: rsa.sig).\n");
+    printf("   -n pvfile       Private key file (default: rsa.priv).\n");
+}
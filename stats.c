@@ -0,0 +1,116 @@
+#include "stats.h"
+
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+//Every total is updated with relaxed atomics so the library can be instrumented from any thread.
+typedef struct StatTotals {
+    _Atomic uint64_t counters[STAT_COUNT];
+    _Atomic uint64_t phase_wall_ns[PHASE_COUNT];
+    _Atomic uint64_t phase_cpu_ns[PHASE_COUNT];
+} StatTotals;
+
+static StatTotals local_totals;
+static StatTotals *totals = &local_totals;
+
+static const char *counter_names[STAT_COUNT] = { "candidates", "trivial_rejects", "mr_rounds",
+    "pow_mod_calls", "pow_mod_bits", "bytes_in", "bytes_out", "blocks" };
+
+static const char *phase_names[PHASE_COUNT]
+    = { "key_parse", "keygen", "encrypt", "decrypt", "hash", "io", "io_wait" };
+
+static uint64_t clock_ns(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+void stats_add(StatCounter counter, uint64_t amount) {
+    atomic_fetch_add_explicit(&totals->counters[counter], amount, memory_order_relaxed);
+}
+
+//Records the current wall and CPU time of the calling thread.
+void stats_start(StatTimer *timer) {
+    timer->wall_ns = clock_ns(CLOCK_MONOTONIC);
+    timer->cpu_ns = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+}
+
+//Adds the time since stats_start to phase. Phases may nest, e.g. io_wait time is also part of encrypt.
+//The io phase runs on the I/O threads and overlaps the others, so io_wait is what the compute stage lost to disk.
+void stats_stop(StatTimer *timer, StatPhase phase) {
+    uint64_t wall = clock_ns(CLOCK_MONOTONIC) - timer->wall_ns;
+    uint64_t cpu = clock_ns(CLOCK_THREAD_CPUTIME_ID) - timer->cpu_ns;
+    atomic_fetch_add_explicit(&totals->phase_wall_ns[phase], wall, memory_order_relaxed);
+    atomic_fetch_add_explicit(&totals->phase_cpu_ns[phase], cpu, memory_order_relaxed);
+}
+
+//Moves the totals into memory shared with processes forked afterwards, so their work is counted here
+//too. Phase times then add up across processes the same way they do across threads.
+//Returns false if the totals stay private to this process.
+bool stats_share(void) {
+    if (totals != &local_totals) {
+        return true;
+    }
+    if (!atomic_is_lock_free(&local_totals.counters[0])) {
+        return false;
+    }
+    StatTotals *shared = (StatTotals *) mmap(
+        NULL, sizeof(StatTotals), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) {
+        return false;
+    }
+    memcpy(shared, &local_totals, sizeof(StatTotals));
+    totals = shared;
+    return true;
+}
+
+//Prints every counter and phase total as a table or as a single JSON object.
+void stats_print(FILE *outfile, bool json) {
+    if (json) {
+        fprintf(outfile, "{\"counters\":{");
+        for (int i = 0; i < STAT_COUNT; i++) {
+            fprintf(outfile, "%s\"%s\":%" PRIu64, i > 0 ? "," : "", counter_names[i],
+                atomic_load(&totals->counters[i]));
+        }
+        fprintf(outfile, "},\"phases\":{");
+        for (int i = 0; i < PHASE_COUNT; i++) {
+            fprintf(outfile, "%s\"%s\":{\"wall_s\":%.6f,\"cpu_s\":%.6f}", i > 0 ? "," : "",
+                phase_names[i], atomic_load(&totals->phase_wall_ns[i]) / 1e9,
+                atomic_load(&totals->phase_cpu_ns[i]) / 1e9);
+        }
+        fprintf(outfile, "}}\n");
+        return;
+    }
+
+    fprintf(outfile, "%-16s %12s\n", "counter", "total");
+    for (int i = 0; i < STAT_COUNT; i++) {
+        fprintf(outfile, "%-16s %12" PRIu64 "\n", counter_names[i],
+            atomic_load(&totals->counters[i]));
+    }
+    fprintf(outfile, "%-16s %12s %12s\n", "phase", "wall (s)", "cpu (s)");
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        fprintf(outfile, "%-16s %12.6f %12.6f\n", phase_names[i],
+            atomic_load(&totals->phase_wall_ns[i]) / 1e9,
+            atomic_load(&totals->phase_cpu_ns[i]) / 1e9);
+    }
+}
+
+//Parses the optional value of --stats. No value selects the table and "json" selects JSON.
+//Returns false for anything else.
+bool stats_parse_arg(const char *arg, bool *json) {
+    if (arg == NULL) {
+        *json = false;
+        return true;
+    }
+    if (strcmp(arg, "json") == 0) {
+        *json = true;
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+typedef enum StatCounter {
+    STAT_CANDIDATES,
+    STAT_TRIVIAL_REJECTS,
+    STAT_MR_ROUNDS,
+    STAT_POW_MOD_CALLS,
+    STAT_POW_MOD_BITS,
+    STAT_BYTES_IN,
+    STAT_BYTES_OUT,
+    STAT_BLOCKS,
+    STAT_COUNT
+} StatCounter;
+
+typedef enum StatPhase {
+    PHASE_KEY_PARSE,
+    PHASE_KEYGEN,
+    PHASE_ENCRYPT,
+    PHASE_DECRYPT,
+    PHASE_HASH,
+    PHASE_IO,
+    PHASE_IO_WAIT,
+    PHASE_COUNT
+} StatPhase;
+
+//getopt_long entry shared by every CLI for --stats[=json]. Its value comes back as 'S'.
+#define STATS_LONG_OPTION { "stats", optional_argument, NULL, 'S' }
+
+typedef struct StatTimer {
+    uint64_t wall_ns;
+    uint64_t cpu_ns;
+} StatTimer;
+
+void stats_add(StatCounter counter, uint64_t amount);
+
+void stats_start(StatTimer *timer);
+
+void stats_stop(StatTimer *timer, StatPhase phase);
+
+void stats_print(FILE *outfile, bool json);
+
+bool stats_share(void);
+
+bool stats_parse_arg(const char *arg, bool *json);
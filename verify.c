@@ -0,0 +1,176 @@
+#include "rsa.h"
+#include "numtheory.h"
+#include "randstate.h"
+#include "stats.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <string.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <gmp.h>
+
+/****************************************************/
+// Filename: verify.c
+// Created: Dylan Do
+/****************************************************/
+
+void help(); //Declaration for the help function.
+
+static struct option long_options[] = { STATS_LONG_OPTION, { 0, 0, 0, 0 } };
+
+int main(int argc, char **argv) {
+
+    //Creating variables needed for verify
+    int opt = 0;
+    mpz_t n, e, s;
+    mpz_inits(n, e, s, NULL);
+    char username[32];
+    bool verbose = false;
+    bool stats = false;
+    bool stats_json = false;
+    //The infiles are the files being verified, one per -i. Set to stdin by default.
+    FILE **infiles = (FILE **) calloc(argc + 1, sizeof(FILE *));
+    char **names = (char **) calloc(argc + 1, sizeof(char *));
+    uint64_t count = 0;
+    char *sig = "rsa.sig";
+    char *pub = "rsa.pub";
+
+    //This while loop is responsible for parsing through the command-lines given by a user.
+    while ((opt = getopt_long(argc, argv, "i:s:n:vh", long_options, NULL)) != -1) {
+
+        //This if statement is responsible for printing out the help statement if the user inputs an unknown command-line.
+        if (opt == '?') {
+            help();
+            return -1;
+        }
+
+        //This are all the cases.
+        switch (opt) {
+        case 'v': verbose = true; break;
+        case 'S':
+            stats = true;
+            if (!stats_parse_arg(optarg, &stats_json)) {
+                help();
+                return -1;
+            }
+            break;
+        case 'h':
+            help();
+            return -1;
+        case 'i':
+            names[count] = optarg;
+            infiles[count++] = fopen(optarg, "r");
+            break;
+        case 's': sig = optarg; break;
+        case 'n': pub = optarg;
+        }
+    }
+
+    if (count == 0) {
+        names[count] = "stdin";
+        infiles[count++] = stdin;
+    }
+    for (uint64_t i = 0; i < count; i++) {
+        if (infiles[i] == NULL) {
+            printf("Error, failed to open input file %s.\n", names[i]);
+            return 1;
+        }
+    }
+
+    FILE *pbfile = fopen(pub, "r");
+    if (pbfile == NULL) {
+        printf("Error, failed to open public key file.");
+        return 1;
+    }
+
+    FILE *sigfile = fopen(sig, "r");
+    if (sigfile == NULL) {
+        printf("Error, failed to open signature file.");
+        return 1;
+    }
+
+    rsa_read_pub(n, e, s, username, pbfile);
+
+    if (verbose) {
+        printf("user = %s\n", username);
+        gmp_printf("n (%zu bits) = %Zd\n", mpz_sizeinbase(n, 2), n);
+        gmp_printf("e (%zu bits) = %Zd\n", mpz_sizeinbase(e, 2), e);
+    }
+
+    //The signature file holds one signature per input, in the order they were given
+    mpz_t *file_s = (mpz_t *) malloc(count * sizeof(mpz_t));
+    for (uint64_t i = 0; i < count; i++) {
+        mpz_init(file_s[i]);
+        if (gmp_fscanf(sigfile, "%Zx\n", file_s[i]) != 1) {
+            printf("Error, signature file holds fewer signatures than inputs.\n");
+            return 1;
+        }
+        if (verbose) {
+            gmp_printf(
+                "s %s (%zu bits) = %Zd\n", names[i], mpz_sizeinbase(file_s[i], 2), file_s[i]);
+        }
+    }
+
+    //Hashing the whole files side by side and checking each digest against its signature
+    bool *verified = (bool *) calloc(count, sizeof(bool));
+    if (!rsa_verify_files(infiles, file_s, count, e, n, verified)) {
+        printf("Error, failed to read input file.\n");
+        return 1;
+    }
+    bool all_verified = true;
+    for (uint64_t i = 0; i < count; i++) {
+        if (count > 1) {
+            printf("%s: ", names[i]);
+        }
+        if (verified[i]) {
+            printf("Signature verified.\n");
+        } else {
+            printf("Error, invalid signature.\n");
+        }
+        all_verified = all_verified && verified[i];
+    }
+
+    //Prints out the instrumentation if indicated by user.
+    if (stats) {
+        stats_print(stderr, stats_json);
+    }
+
+    mpz_clears(n, e, s, NULL);
+    for (uint64_t i = 0; i < count; i++) {
+        mpz_clear(file_s[i]);
+        fclose(infiles[i]);
+    }
+    free(file_s);
+    free(verified);
+    free(infiles);
+    free(names);
+    fclose(sigfile);
+    fclose(pbfile);
+    return all_verified ? 0 : 1;
+}
+
+//Helper function that prints out the help statement.
+void help() {
+    printf("SYNOPSIS\n");
+    printf("   Verifies RSA signatures over the SHA-256 digests of files.\n");
+    printf("   Signatures are created by the sign program.\n");
+    printf("\n");
+    printf("USAGE\n");
+    printf("   ./verify [-hv] [-i infile]... [-s sigfile] [-n pubkey]\n");
+    printf("\n");
+    printf("OPTIONS\n");
+    printf("   -h              Display program help and usage.\n");
+    printf("   -v              Display verbose program output.\n");
+    printf("   --stats[=json]  Print operation counters and phase timings to stderr.\n");
+    printf("   -i infile       Input file to verify, may be repeated (default: stdin).\n");
+    printf("                   Several inputs are hashed in parallel.\n");
+    printf("   -s sigfile      Signature file, one line per input (default: rsa.sig).\n");
+    printf("   -n pbfile       Public key file (default: rsa.pub).\n");
+}